@@ -0,0 +1,183 @@
+#!/usr/bin/env python3
+##########################################################################
+#                                  _   _ ____  _
+#  Project                     ___| | | |  _ \| |
+#                             / __| | | | |_) | |
+#                            | (__| |_| |  _ <| |___
+#                             \___|\___/|_| \_\_____|
+#
+# Copyright (C) Daniel Stenberg, <daniel@haxx.se>, et al.
+#
+# This software is licensed as described in the file COPYING, which
+# you should have received as part of this distribution. The terms
+# are also available at https://curl.se/docs/copyright.html.
+#
+# You may opt to use, copy, modify, merge, publish, distribute and/or sell
+# copies of the Software, and permit persons to whom the Software is
+# furnished to do so, under the terms of the COPYING file.
+#
+# This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+# KIND, either express or implied.
+#
+# SPDX-License-Identifier: curl
+#
+##########################################################################
+
+# Differential test: run a regular trurl build and one built with
+# TRURL_NO_FASTPATH (libcurl parses everything) over the tests.json command
+# lines and a random URL corpus, and make sure they output the same thing.
+
+import re
+import sys
+import json
+import random
+import tempfile
+from os import getcwd, path, unlink
+from subprocess import PIPE, run
+
+PROGNAME = "trurl"
+TESTFILE = "tests.json"
+
+# each list starts with entries the fast path accepts, the rest of them
+# must make it hand over to libcurl or produce the same result anyway
+SCHEMES = ["http", "https", "HTTP", "hTtps", "ftp", "", "ws"]
+LABELS = ["example", "curl", "se", "com", "a", "x-y", "w3", "-z", "0", "12",
+          "0x10", "Upper", "und_er", "åäö", "xn--4cab6c", ""]
+HOSTS = ["127.0.0.1", "127.1", "0x7f.1", "1.2.3", "[::1]", "[fe80::1%25eth0]",
+         "user@host", "user:pw@host", "example.com.", "%61.example"]
+PORTS = ["", ":1", ":8080", ":65535", ":80", ":443", ":080", ":", ":65536",
+         ":123456"]
+SEGMENTS = ["a", "b.c", "~u", "A-Z_", "index.html", "", "..", ".", "x%41",
+            "a*b", "sp ace", "%2e", "é", "a+b", "a,b"]
+PAIRS = ["a=1", "b", "x*y", "k=v", "=v", "k=", "=", "UTM_source=x", "",
+         "c=d=e", "q=%20", "p+q", "a%3db", "é=1", "a;b"]
+FRAGMENTS = ["", "#frag", "#a-b.c_d~e", "#a*b", "#", "#%41", "#a#b"]
+PLAIN = {id(SCHEMES): 2, id(LABELS): 7, id(PORTS): 4, id(SEGMENTS): 5,
+         id(PAIRS): 8, id(FRAGMENTS): 3}
+# these options write timings to stderr, which differ from run to run
+TIMING = ["--stats", "--stats-json", "--slowest"]
+HISTOGRAM = re.compile(rb"^ *(# - #: #|\[#, #, #\],?)$")
+
+
+def pick(rnd, plain, items):
+    # mostly stick to the fast path friendly entries for plain URLs
+    if plain and rnd.random() < 0.97:
+        return rnd.choice(items[:PLAIN[id(items)]])
+    return rnd.choice(items)
+
+
+def genurl(rnd):
+    plain = rnd.random() < 0.5
+    scheme = pick(rnd, plain, SCHEMES)
+    if not plain and rnd.random() < 0.1:
+        host = rnd.choice(HOSTS)
+    else:
+        host = ".".join(pick(rnd, plain, LABELS)
+                        for _ in range(rnd.randint(1, 4)))
+    url = (scheme + "://" if scheme else "") + host + pick(rnd, plain, PORTS)
+    if rnd.random() < 0.9:
+        url += "/" + "/".join(pick(rnd, plain, SEGMENTS)
+                              for _ in range(rnd.randint(0, 5)))
+    if rnd.random() < 0.6:
+        url += "?" + "&".join(pick(rnd, plain, PAIRS)
+                              for _ in range(rnd.randint(1, 5)))
+    return url + pick(rnd, plain, FRAGMENTS)
+
+
+def runboth(cmds, args, stdin=b""):
+    return [run([c] + args, input=stdin, stdout=PIPE, stderr=PIPE)
+            for c in cmds]
+
+
+def untimed(stderr):
+    # blank out the numbers, drop the histogram rows (their number depends
+    # on the spread of the latencies) and sort the rest, as the slowest URL
+    # list is in the order of their times
+    lines = re.sub(rb"[0-9]+(\.[0-9]+)?", b"#", stderr).split(b"\n")
+    return sorted(x for x in lines if not HISTOGRAM.match(x))
+
+
+def compare(what, outputs):
+    a, b = outputs
+    aerr, berr = a.stderr, b.stderr
+    if any(opt in what for opt in TIMING):
+        aerr, berr = untimed(aerr), untimed(berr)
+    if (a.stdout, aerr, a.returncode) != \
+       (b.stdout, berr, b.returncode):
+        print(f"difference: {what}", file=sys.stderr)
+        print(f"  fastpath: {a.stdout!r} {a.stderr!r} {a.returncode}",
+              file=sys.stderr)
+        print(f"  libcurl:  {b.stdout!r} {b.stderr!r} {b.returncode}",
+              file=sys.stderr)
+        return False
+    return True
+
+
+def main(argv):
+    baseDir = path.dirname(path.realpath(argv[0]))
+    trurl = path.join(getcwd(), PROGNAME)
+    reference = path.join(getcwd(), PROGNAME + "-nofastpath")
+    count = 100000
+    seed = 1
+
+    for arg in argv[1:]:
+        if arg.startswith("--trurl="):
+            trurl = arg[len("--trurl="):]
+        elif arg.startswith("--reference="):
+            reference = arg[len("--reference="):]
+        elif arg.startswith("--count="):
+            count = int(arg[len("--count="):])
+        elif arg.startswith("--seed="):
+            seed = int(arg[len("--seed="):])
+        else:
+            print(f"unknown argument: {arg}", file=sys.stderr)
+            return 1
+
+    cmds = [trurl, reference]
+    failed = 0
+    with open(path.join(baseDir, TESTFILE), "r", encoding="utf-8") as file:
+        allTests = json.load(file)
+    for test in allTests:
+        args = test["input"]["arguments"]
+        stdin = test["input"].get("stdin", "").encode()
+        if not compare(args, runboth(cmds, args, stdin)):
+            failed += 1
+    print(f"{len(allTests)} test command lines compared")
+
+    rnd = random.Random(seed)
+    urls = [genurl(rnd) for _ in range(count)]
+    with tempfile.NamedTemporaryFile("w", encoding="utf-8",
+                                     delete=False) as corpus:
+        corpus.write("\n".join(urls) + "\n")
+    try:
+        # one URL per line in and out makes it possible to pinpoint the
+        # first difference, so use --url-file and compare line by line
+        a, b = runboth(cmds, ["--url-file", corpus.name])
+        alines = a.stdout.split(b"\n")
+        blines = b.stdout.split(b"\n")
+        if a.stderr != b.stderr or a.returncode != b.returncode:
+            print("difference in stderr or exit code for the corpus",
+                  file=sys.stderr)
+            failed += 1
+        for n, (x, y) in enumerate(zip(alines, blines)):
+            if x != y:
+                print(f"first corpus difference at output line {n + 1}: "
+                      f"{x!r} vs {y!r}", file=sys.stderr)
+                failed += 1
+                break
+        if len(alines) != len(blines):
+            print("corpus output line counts differ", file=sys.stderr)
+            failed += 1
+    finally:
+        unlink(corpus.name)
+    print(f"{count} random URLs compared (seed {seed})")
+
+    if failed:
+        print(f"Failed! - {failed} differences")
+        return 1
+    print("Passed! - no differences")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
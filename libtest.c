@@ -0,0 +1,145 @@
+/***************************************************************************
+ *                             _                   _
+ *  Project                   | |_ _ __ _   _ _ __| |
+ *                            | __| '__| | | | '__| |
+ *                            | |_| |  | |_| | |  | |
+ *                             \__|_|   \__,_|_|  |_|
+ *
+ * Copyright (C) Daniel Stenberg, <daniel@haxx.se>, et al.
+ *
+ * This software is licensed as described in the file COPYING, which
+ * you should have received as part of this distribution. The terms
+ * are also available at https://curl.se/docs/copyright.html.
+ *
+ * You may opt to use, copy, modify, merge, publish, distribute and/or sell
+ * copies of the Software, and permit persons to whom the Software is
+ * furnished to do so, under the terms of the COPYING file.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ * SPDX-License-Identifier: curl
+ *
+ ***************************************************************************/
+
+/*
+ * Tests of the library API in trurl.h. The command line behavior is tested
+ * by test.py, this checks what is particular to the library: contexts,
+ * buffers and errors returned instead of exits.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <curl/curl.h>
+
+#include "trurl.h"
+
+static int failed;
+static int tests;
+
+static void check(const char *url, int argc, const char **argv,
+                  TRURLcode expect_rc, const char *expect)
+{
+  char buf[256];
+  size_t len = 0;
+  TRURLcode rc;
+  struct trurl *t = trurl_new();
+  tests++;
+  if(!t) {
+    printf("FAILED: out of memory\n");
+    failed++;
+    return;
+  }
+  rc = trurl_setopt(t, argc, argv);
+  if(!rc)
+    rc = trurl_url(t, url, buf, sizeof(buf), &len);
+  if(rc != expect_rc) {
+    printf("FAILED: %s returned %d, expected %d (%s)\n",
+           url ? url : "NULL", (int)rc, (int)expect_rc, trurl_errmsg(t));
+    failed++;
+  }
+  else if(!rc && (strcmp(buf, expect) || (len != strlen(expect)))) {
+    printf("FAILED: %s output '%s', expected '%s'\n",
+           url ? url : "NULL", buf, expect);
+    failed++;
+  }
+  else if(rc && expect && strcmp(trurl_errmsg(t), expect)) {
+    printf("FAILED: %s error '%s', expected '%s'\n",
+           url ? url : "NULL", trurl_errmsg(t), expect);
+    failed++;
+  }
+  trurl_free(t);
+}
+
+static void reuse(void)
+{
+  /* one context, several URLs, with an error in between */
+  static const char *argv[] = { "--get", "{host}", "--sort-query" };
+  char buf[64];
+  size_t len;
+  struct trurl *t = trurl_new();
+  tests++;
+  if(!t ||
+     trurl_setopt(t, 3, argv) ||
+     trurl_url(t, "https://a.example/?b=1&a=2", buf, sizeof(buf), &len) ||
+     strcmp(buf, "a.example\n") ||
+     (trurl_url(t, "https://a:b:c", buf, sizeof(buf), &len) !=
+      TRURLE_BADURL) ||
+     trurl_url(t, "b.example", buf, sizeof(buf), &len) ||
+     strcmp(buf, "b.example\n") ||
+     (trurl_url(t, "c.example", buf, 5, &len) != TRURLE_TOO_SMALL) ||
+     (len != 10) ||
+     (trurl_setopt(t, 3, argv) != TRURLE_FLAG)) {
+    printf("FAILED: context reuse\n");
+    failed++;
+  }
+  trurl_free(t);
+}
+
+int main(void)
+{
+  static const char *get[] = { "--get", "{scheme} {default:port}" };
+  static const char *json[] = { "--json" };
+  static const char *iter[] = { "--iterate", "port=1 2" };
+  static const char *query[] = { "--append", "query=a=b", "--qtrim", "c" };
+  static const char *badopt[] = { "--nope" };
+  static const char *badget[] = { "--get", "{nope}" };
+  static const char *url[] = { "--url", "example.com" };
+  static const char *set[] = { "-s", "host=example.com", "-s", "scheme=ftp" };
+  static const char *badset[] = { "-s", "path=x" };
+
+  curl_global_init(CURL_GLOBAL_ALL);
+
+  check("example.com", 0, NULL, TRURLE_OK, "http://example.com/\n");
+  check("https://example.com:8443/a/../b?x", 0, NULL, TRURLE_OK,
+        "https://example.com:8443/b?x\n");
+  check("https://example.com", 2, get, TRURLE_OK, "https 443\n");
+  check("example.com?c=d", 4, query, TRURLE_OK, "http://example.com/?a=b\n");
+  check("ftp://x", 2, iter, TRURLE_OK, "ftp://x:1/\nftp://x:2/\n");
+  check("https://x/?a=b", 1, json, TRURLE_OK,
+        "[\n  {\n    \"url\": \"https://x/?a=b\",\n"
+        "    \"parts\": {\n      \"scheme\": \"https\",\n"
+        "      \"host\": \"x\",\n      \"path\": \"/\",\n"
+        "      \"query\": \"a=b\"\n    },\n"
+        "    \"params\": [\n      {\n        \"key\": \"a\",\n"
+        "        \"value\": \"b\"\n      }\n    ]\n  }\n]\n");
+  check(NULL, 4, set, TRURLE_OK, "ftp://example.com/\n");
+  check(NULL, 0, NULL, TRURLE_URL, "not enough input for a URL");
+  check("https://a:b:c", 0, NULL, TRURLE_BADURL, NULL);
+  check("file:///x", 2, badset, TRURLE_BADURL,
+        "Bad file:// URL [file://x]");
+  check("x", 1, badopt, TRURLE_FLAG, "unknown option: --nope");
+  check("x", 2, badget, TRURLE_GET,
+        "\"nope\" is not a recognized URL component");
+  check("x", 2, url, TRURLE_FLAG, "--url is not supported by the library");
+  reuse();
+
+  curl_global_cleanup();
+
+  if(failed) {
+    printf("Failed! - %d of %d library tests\n", failed, tests);
+    return 1;
+  }
+  printf("Passed! - %d library tests\n", tests);
+  return 0;
+}
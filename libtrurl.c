@@ -0,0 +1,5631 @@
+/***************************************************************************
+ *                             _                   _
+ *  Project                   | |_ _ __ _   _ _ __| |
+ *                            | __| '__| | | | '__| |
+ *                            | |_| |  | |_| | |  | |
+ *                             \__|_|   \__,_|_|  |_|
+ *
+ * Copyright (C) Daniel Stenberg, <daniel@haxx.se>, et al.
+ *
+ * This software is licensed as described in the file COPYING, which
+ * you should have received as part of this distribution. The terms
+ * are also available at https://curl.se/docs/copyright.html.
+ *
+ * You may opt to use, copy, modify, merge, publish, distribute and/or sell
+ * copies of the Software, and permit persons to whom the Software is
+ * furnished to do so, under the terms of the COPYING file.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ * SPDX-License-Identifier: curl
+ *
+ ***************************************************************************/
+
+#include "trurl_int.h" /* first, it has the platform setup */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <curl/mprintf.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
+#include "trurl.h"
+#include "version.h"
+
+#ifdef _MSC_VER
+#define strdup _strdup
+#endif
+
+#if CURL_AT_LEAST_VERSION(7,77,0)
+#define SUPPORTS_NORM_IPV4
+#endif
+#if CURL_AT_LEAST_VERSION(7,81,0)
+#define SUPPORTS_ZONEID
+#endif
+#if CURL_AT_LEAST_VERSION(7,80,0)
+#define SUPPORTS_URL_STRERROR
+#endif
+#if CURL_AT_LEAST_VERSION(7,78,0)
+#define SUPPORTS_ALLOW_SPACE
+#else
+#define CURLU_ALLOW_SPACE 0
+#endif
+#if CURL_AT_LEAST_VERSION(7,88,0) && !defined(_WIN32)
+#define SUPPORTS_PUNYCODE
+#endif
+#if CURL_AT_LEAST_VERSION(8,3,0)
+#define SUPPORTS_PUNY2IDN
+#endif
+#if CURL_AT_LEAST_VERSION(7,30,0)
+#define SUPPORTS_IMAP_OPTIONS
+#endif
+#if CURL_AT_LEAST_VERSION(8,9,0)
+#define SUPPORTS_NO_GUESS_SCHEME
+#else
+#define CURLU_NO_GUESS_SCHEME 0
+#endif
+#if CURL_AT_LEAST_VERSION(8,8,0)
+#define SUPPORTS_GET_EMPTY
+#else
+#define CURLU_GET_EMPTY 0
+#endif
+
+#define NUM_COMPONENTS 10 /* excluding "url" */
+
+#define REPLACE_NULL_BYTE '.' /* for query:key extractions */
+
+enum {
+  VARMODIFIER_URLENCODED = 1 << 1,
+  VARMODIFIER_DEFAULT    = 1 << 2,
+  VARMODIFIER_PUNY       = 1 << 3,
+  VARMODIFIER_PUNY2IDN   = 1 << 4,
+  VARMODIFIER_EMPTY      = 1 << 8,
+};
+
+static const struct var variables[] = {
+  { "scheme",   CURLUPART_SCHEME },
+  { "user",     CURLUPART_USER },
+  { "password", CURLUPART_PASSWORD },
+  { "options",  CURLUPART_OPTIONS },
+  { "host",     CURLUPART_HOST },
+  { "port",     CURLUPART_PORT },
+  { "path",     CURLUPART_PATH },
+  { "query",    CURLUPART_QUERY },
+  { "fragment", CURLUPART_FRAGMENT },
+  { "zoneid",   CURLUPART_ZONEID },
+  { NULL, 0 }
+};
+
+#define ERROR_PREFIX PROGNAME " error: "
+#define WARN_PREFIX  PROGNAME " note: "
+
+#ifndef SUPPORTS_URL_STRERROR
+/* provide a fake local mockup */
+static char *curl_url_strerror(CURLUcode error)
+{
+  static char buffer[128];
+  curl_msnprintf(buffer, sizeof(buffer), "URL error %u", (int)error);
+  return buffer;
+}
+#endif
+
+/* Mapping table to go from lowercase to uppercase for plain ASCII.*/
+static const unsigned char touppermap[256] = {
+  0,   1,   2,   3,   4,   5,   6,   7,   8,   9,   10,  11,  12,  13,  14,
+  15,  16,  17,  18,  19,  20,  21,  22,  23,  24,  25,  26,  27,  28,  29,
+  30,  31,  32,  33,  34,  35,  36,  37,  38,  39,  40,  41,  42,  43,  44,
+  45,  46,  47,  48,  49,  50,  51,  52,  53,  54,  55,  56,  57,  58,  59,
+  60,  61,  62,  63,  64,  65,  66,  67,  68,  69,  70,  71,  72,  73,  74,
+  75,  76,  77,  78,  79,  80,  81,  82,  83,  84,  85,  86,  87,  88,  89,
+  90,  91,  92,  93,  94,  95,  96,  65,  66,  67,  68,  69,  70,  71,  72,
+  73,  74,  75,  76,  77,  78,  79,  80,  81,  82,  83,  84,  85,  86,  87,
+  88,  89,  90,  123, 124, 125, 126, 127, 128, 129, 130, 131, 132, 133, 134,
+  135, 136, 137, 138, 139, 140, 141, 142, 143, 144, 145, 146, 147, 148, 149,
+  150, 151, 152, 153, 154, 155, 156, 157, 158, 159, 160, 161, 162, 163, 164,
+  165, 166, 167, 168, 169, 170, 171, 172, 173, 174, 175, 176, 177, 178, 179,
+  180, 181, 182, 183, 184, 185, 186, 187, 188, 189, 190, 191, 192, 193, 194,
+  195, 196, 197, 198, 199, 200, 201, 202, 203, 204, 205, 206, 207, 208, 209,
+  210, 211, 212, 213, 214, 215, 216, 217, 218, 219, 220, 221, 222, 223, 224,
+  225, 226, 227, 228, 229, 230, 231, 232, 233, 234, 235, 236, 237, 238, 239,
+  240, 241, 242, 243, 244, 245, 246, 247, 248, 249, 250, 251, 252, 253, 254,
+  255
+};
+
+/* Portable, ASCII-consistent toupper. Do not use toupper() because its
+   behavior is altered by the current locale. */
+#define raw_toupper(in) touppermap[(unsigned int)in]
+
+/* the unusual thing here is that we let '*' remain as-is */
+#define ISURLPUNTCS(x) \
+  (((x) == '-') || ((x) == '.') || ((x) == '_') || \
+   ((x) == '~') || ((x) == '*'))
+#define ISUPPER(x)      (((x) >= 'A') && ((x) <= 'Z'))
+#define ISLOWER(x)      (((x) >= 'a') && ((x) <= 'z'))
+#define ISDIGIT(x)      (((x) >= '0') && ((x) <= '9'))
+#define ISALNUM(x)      (ISDIGIT(x) || ISLOWER(x) || ISUPPER(x))
+#define ISXDIGIT(x)     (ISDIGIT(x) || (((x) >= 'a') && ((x) <= 'f')) || \
+                         (((x) >= 'A') && ((x) <= 'F')))
+#define ISUNRESERVED(x) (ISALNUM(x) || ISURLPUNTCS(x))
+
+/*
+ * casecompare() does ASCII based case insensitive checks, as a strncasecmp
+ * replacement.
+ */
+
+static int casecompare(const char *first, const char *second, size_t max)
+{
+  while(*first && *second && max) {
+    int diff = raw_toupper(*first) - raw_toupper(*second);
+    if(diff)
+      /* get out of the loop as soon as they don't match */
+      return diff;
+    max--;
+    first++;
+    second++;
+  }
+  if(!max)
+    return 0; /* identical to this point */
+
+  return raw_toupper(*first) - raw_toupper(*second);
+}
+
+static void message_low(const char *prefix, const char *suffix,
+                        const char *fmt, va_list ap)
+{
+  fputs(prefix, stderr);
+  vfprintf(stderr, fmt, ap);
+  fputs(suffix, stderr);
+}
+
+/* the library keeps quiet */
+static void warnf_low(struct option *o, const char *fmt, va_list ap)
+{
+  o->memoskip = true; /* a repeat would not say it again */
+  if(!o->library)
+    message_low(WARN_PREFIX, "\n", fmt, ap);
+}
+
+static void warnf(struct option *o, const char *fmt, ...)
+{
+  va_list ap;
+  va_start(ap, fmt);
+  warnf_low(o, fmt, ap);
+  va_end(ap);
+}
+
+TRURL_NORETURN static void help(void)
+{
+  int i;
+  fputs(
+    "Usage: " PROGNAME " [options] [URL]\n"
+    "  -a, --append [component]=[data]  - append data to component\n"
+    "      --accept-space               - give in to this URL abuse\n"
+    "      --alloc-stats                - show allocations per URL\n"
+    "      --as-idn                     - encode hostnames in idn\n"
+    "      --cardinality [components]   - estimate distinct values\n"
+    "      --compile-hosts [file]       - save the host list precompiled\n"
+    "      --count-by [component]       - count URLs per component value\n"
+    "      --curl                       - only schemes supported by libcurl\n"
+    "      --default-port               - add known default ports\n"
+    "      --exclude-hosts [file]       - drop URLs with these hosts\n"
+    "  -f, --url-file [file/-]          - read URLs from file or stdin\n"
+    "  -g, --get [{component}s]         - output component(s)\n"
+    "  -h, --help                       - this help\n"
+    "      --iterate [component]=[list] - create multiple URL outputs\n"
+    "      --iterate-file [comp]=[file] - iterate over lines in file\n"
+    "      --json                       - output URL as JSON\n"
+    "      --keep-port                  - keep known default ports\n"
+    "      --listen [socket]            - answer requests on a socket\n"
+    "      --memo [bytes]               - reuse the output of repeated lines\n"
+    "      --no-guess-scheme            - require scheme in URLs\n"
+    "      --only-hosts [file]          - only URLs with these hosts\n"
+    "      --progress [seconds]         - show progress this often\n"
+    "      --psl [file]                 - public suffix list to use\n"
+    "      --punycode                   - encode hostnames in punycode\n"
+    "      --qtrim [what]               - trim the query\n"
+    "      --query-separator [letter]   - if something else than '&'\n"
+    "      --quiet                      - Suppress (some) notes and comments\n"
+    "      --redirect [URL]             - redirect to this\n"
+    "      --replace [data]             - replaces a query [data]\n"
+    "      --replace-append [data]      - appends a new query if not found\n"
+    "      --server                     - answer requests on stdin\n"
+    "  -s, --set [component]=[data]     - set component content\n"
+    "      --slowest [num]              - show the slowest URLs\n"
+    "      --sort-query                 - alpha-sort the query pairs\n"
+    "      --stats                      - show statistics on stderr\n"
+    "      --stats-json                 - show statistics as JSON\n"
+    "      --top [num]                  - only count the most common\n"
+    "      --unique                     - only output each URL once\n"
+    "      --unique-approx [bytes,rate] - same, in this much memory\n"
+    "      --unique-exact               - same, also compare the URLs\n"
+    "      --unique-state [file]        - load and save --unique-approx\n"
+    "      --url [URL]                  - URL to work with\n"
+    "      --urlencode                  - show components URL encoded\n"
+    "  -v, --version                    - show version\n"
+    "      --verify                     - return error on (first) bad URL\n"
+    "      --where [expression]         - only URLs that match\n"
+    "      --where-ip [file]            - filter on address prefixes\n"
+    "      --workers [num]              - threads answering --listen\n"
+    " URL COMPONENTS:\n"
+    "  ",
+    stdout);
+  fputs("url, ", stdout);
+  for(i = 0; i < NUM_COMPONENTS; i++) {
+    printf("%s%s", i ? ", " : "", variables[i].name);
+  }
+  fputs("\n", stdout);
+  exit(0);
+}
+
+TRURL_NORETURN static void show_version(void)
+{
+  curl_version_info_data *data = curl_version_info(CURLVERSION_NOW);
+  /* puny code isn't guaranteed based on the version, so it must be polled
+   * from libcurl */
+#if defined(SUPPORTS_PUNYCODE) || defined(SUPPORTS_PUNY2IDN)
+  bool supports_puny = (data->features & CURL_VERSION_IDN) != 0;
+#endif
+#ifdef SUPPORTS_IMAP_OPTIONS
+  bool supports_imap;
+#if CURL_AT_LEAST_VERSION(8,19,0)
+  supports_imap = true;
+#else
+  const char * const *protocol_name = data->protocols;
+  supports_imap = false;
+  while(*protocol_name && !supports_imap) {
+    supports_imap = !strncmp(*protocol_name, "imap", 4);
+    protocol_name++;
+  }
+#endif
+#endif
+
+  fprintf(stdout, "%s version %s libcurl/%s [built-with %s]\n",
+          PROGNAME, TRURL_VERSION_TXT, data->version, LIBCURL_VERSION);
+  fprintf(stdout, "features:");
+#ifdef SUPPORTS_GET_EMPTY
+  fprintf(stdout, " get-empty");
+#endif
+#ifdef SUPPORTS_IMAP_OPTIONS
+  if(supports_imap)
+    fprintf(stdout, " imap-options");
+#endif
+#ifdef SUPPORTS_NO_GUESS_SCHEME
+  fprintf(stdout, " no-guess-scheme");
+#endif
+#ifdef SUPPORTS_NORM_IPV4
+  fprintf(stdout, " normalize-ipv4");
+#endif
+#ifdef SUPPORTS_PUNYCODE
+  if(supports_puny)
+    fprintf(stdout, " punycode");
+#endif
+#ifdef SUPPORTS_PUNY2IDN
+  if(supports_puny)
+    fprintf(stdout, " punycode2idn");
+#endif
+#ifdef SUPPORTS_URL_STRERROR
+  fprintf(stdout, " url-strerror");
+#endif
+#ifdef SUPPORTS_ALLOW_SPACE
+  fprintf(stdout, " white-space");
+#endif
+#ifdef SUPPORTS_ZONEID
+  fprintf(stdout, " zone-id");
+#endif
+  if(data->version_num >= 0x080f00)
+    fprintf(stdout, " uppercase-hex");
+
+  fprintf(stdout, "\n");
+  exit(0);
+}
+
+void trurl_warnf(struct option *o, const char *fmt, ...)
+{
+  if(!o->quiet_warnings) {
+    va_list ap;
+    va_start(ap, fmt);
+    warnf_low(o, fmt, ap);
+    va_end(ap);
+  }
+}
+
+static char qdeleted[1]; /* the string of a deleted pair */
+
+/*
+ * The per-URL temporaries (the query pairs and what it takes to create
+ * them) are allocated from an arena that is reset after each URL, so that
+ * the chunks are reused and nothing is freed one by one.
+ */
+#define ARENA_CHUNK 16384
+
+struct arenachunk {
+  struct arenachunk *next;
+  size_t size; /* number of bytes of data following this struct */
+  size_t used;
+};
+
+static void *arenaalloc(struct option *o, size_t size)
+{
+  struct arenachunk *c;
+  struct arenachunk *last = NULL;
+  /* keep everything aligned for a pointer */
+  size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+  for(c = o->arenacurrent; c; c = c->next) {
+    if(c->size - c->used >= size) {
+      void *ptr = (char *)&c[1] + c->used;
+      c->used += size;
+      o->arenacurrent = c;
+      return ptr;
+    }
+    last = c;
+  }
+  c = malloc(sizeof(struct arenachunk) +
+             (size > ARENA_CHUNK ? size : ARENA_CHUNK));
+  if(!c)
+    return NULL;
+  o->allocs++;
+  c->next = NULL;
+  c->size = size > ARENA_CHUNK ? size : ARENA_CHUNK;
+  c->used = size;
+  if(last)
+    last->next = c;
+  else
+    o->arena = c;
+  o->arenacurrent = c;
+  return &c[1];
+}
+
+/* release everything allocated from the arena, but keep the memory */
+UNITTEST void arenareset(struct option *o)
+{
+  struct arenachunk *c;
+  for(c = o->arena; c; c = c->next)
+    c->used = 0;
+  o->arenacurrent = o->arena;
+}
+
+static void arenafree(struct option *o)
+{
+  while(o->arena) {
+    struct arenachunk *next = o->arena->next;
+    free(o->arena);
+    o->arena = next;
+  }
+  o->arenacurrent = NULL;
+}
+
+/* zero terminated copy in the arena */
+static char *arenadup(struct option *o, const char *str, size_t len)
+{
+  char *dup = arenaalloc(o, len + 1);
+  if(dup) {
+    memcpy(dup, str, len);
+    dup[len] = 0;
+  }
+  return dup;
+}
+
+static int hexval(char c)
+{
+  if(ISDIGIT(c))
+    return c - '0';
+  if((c >= 'a') && (c <= 'f'))
+    return c - 'a' + 10;
+  if((c >= 'A') && (c <= 'F'))
+    return c - 'A' + 10;
+  return -1;
+}
+
+/* URL decode into the arena, like curl_easy_unescape() does */
+static char *arenadecode(struct option *o, const char *str, size_t len,
+                         size_t *olen)
+{
+  char *dec = arenaalloc(o, len + 1);
+  char *p = dec;
+  if(!dec)
+    return NULL;
+  while(len) {
+    int hi;
+    int lo;
+    if((*str == '%') && (len > 2) &&
+       ((hi = hexval(str[1])) >= 0) && ((lo = hexval(str[2])) >= 0)) {
+      *p++ = (char)((hi << 4) | lo);
+      str += 3;
+      len -= 3;
+    }
+    else {
+      *p++ = *str++;
+      len--;
+    }
+  }
+  *p = 0;
+  *olen = p - dec;
+  return dec;
+}
+
+/* the handles of the URL being worked on */
+static void urlcleanup(struct option *o)
+{
+  curl_url_cleanup(o->work);
+  curl_url_cleanup(o->uh);
+  o->work = o->uh = NULL;
+  curl_free(o->ourl);
+  o->ourl = NULL;
+}
+
+/* --psl as loaded by the tool, the --server and --listen contexts that are
+   given the same file use it too */
+static struct hostlist *sharedpsl;
+
+static void hostsfree(struct hostlist *l)
+{
+  if(l->map) {
+#ifndef _WIN32
+    munmap(l->map, l->maplen);
+#else
+    free(l->map);
+#endif
+  }
+  else {
+    free(l->slot);
+    free(l->labels);
+  }
+  free(l);
+}
+
+void trurl_cleanup_options(struct option *o)
+{
+  if(!o)
+    return;
+  curl_slist_free_all(o->url_list);
+  curl_slist_free_all(o->set_list);
+  curl_slist_free_all(o->append_query);
+  curl_slist_free_all(o->trim_list);
+  curl_slist_free_all(o->replace_list);
+  curl_slist_free_all(o->append_path);
+  o->url_list = o->set_list = o->append_query =
+    o->trim_list = o->replace_list = o->append_path = NULL;
+  while(o->niters) {
+    struct iterinfo *it = &o->iters[--o->niters];
+    free(it->value);
+    if(it->file)
+      fclose(it->file);
+  }
+  free(o->iters);
+  o->iters = NULL;
+  urlcleanup(o);
+  /* pending output goes out before anything else is said */
+  trurl_outflush(o);
+  free(o->out.buf);
+  memset(&o->out, 0, sizeof(o->out));
+  arenafree(o);
+  if(o->counter) {
+    struct counter *c = o->counter;
+    size_t i;
+    for(i = 0; c->top && (i < c->nentries); i++)
+      free(c->entry[i].topkey);
+    free(c->entry);
+    free(c->slot);
+    free(c->keys);
+    curl_free(c->format);
+    free(c);
+    o->counter = NULL;
+  }
+  if(o->cardinality) {
+    struct cardinality *c = o->cardinality;
+    size_t i;
+    for(i = 0; i < c->nsketches; i++)
+      curl_free(c->sketch[i].format);
+    free(c->sketch);
+    free(c->names);
+    free(c);
+    o->cardinality = NULL;
+  }
+  if(o->iptree) {
+    free(o->iptree->node);
+    free(o->iptree->names);
+    free(o->iptree);
+    o->iptree = NULL;
+  }
+  if(o->exclude) {
+    hostsfree(o->exclude);
+    o->exclude = NULL;
+  }
+  if(o->only) {
+    hostsfree(o->only);
+    o->only = NULL;
+  }
+  if(o->memo) {
+    size_t i;
+    for(i = 0; i < o->memo->nentries; i++)
+      free(o->memo->entry[i].data);
+    free(o->memo->entry);
+    free(o->memo->bucket);
+    free(o->memo);
+    o->memo = NULL;
+  }
+  if(o->idn) {
+    size_t i;
+    for(i = 0; i < o->idn->nentries; i++) {
+      curl_free(o->idn->entry[i].host);
+      curl_free(o->idn->entry[i].conv);
+    }
+    free(o->idn);
+    o->idn = NULL;
+  }
+  if(o->psl) {
+    /* the shared one goes with the tool */
+    if(!o->library || (o->psl != sharedpsl)) {
+      if(o->psl == sharedpsl)
+        sharedpsl = NULL;
+      hostsfree(o->psl);
+    }
+    o->psl = NULL;
+  }
+  if(o->where) {
+    size_t i;
+    for(i = 0; i < o->where->nnodes; i++) {
+      curl_free(o->where->node[i].format);
+      curl_free(o->where->node[i].value);
+    }
+    free(o->where->node);
+    free(o->where);
+    o->where = NULL;
+  }
+  if(o->unique) {
+    free(o->unique->hash);
+    free(o->unique->where);
+    free(o->unique->data);
+    free(o->unique->bloom);
+    free(o->unique);
+    o->unique = NULL;
+  }
+  if(o->stats) {
+    unsigned int i;
+    for(i = 0; i < o->stats->nslow; i++)
+      free(o->stats->slow[i].url);
+    free(o->stats->slow);
+    free(o->stats);
+    o->stats = NULL;
+  }
+}
+
+static void errorf_low(const char *fmt, va_list ap)
+{
+  message_low(ERROR_PREFIX, "\n"
+              ERROR_PREFIX "Try " PROGNAME " -h for help\n", fmt, ap);
+}
+
+TRURL_NORETURN static void errorv(struct option *o, int exit_code,
+                                  const char *fmt, va_list ap)
+{
+  if(o->jmp) {
+    /* in a library call, return the error to the application */
+    curl_mvsnprintf(o->errmsg, sizeof(o->errmsg), fmt, ap);
+    o->error = exit_code;
+    longjmp(*o->jmp, 1);
+  }
+  errorf_low(fmt, ap);
+  trurl_cleanup_options(o);
+  curl_global_cleanup();
+  exit(exit_code);
+}
+
+TRURL_NORETURN static void errorf(struct option *o, int exit_code,
+                                  const char *fmt, ...)
+{
+  va_list ap;
+  va_start(ap, fmt);
+  errorv(o, exit_code, fmt, ap);
+}
+
+/* for the tool */
+void trurl_errorf(struct option *o, int exit_code, const char *fmt, ...)
+{
+  va_list ap;
+  va_start(ap, fmt);
+  errorv(o, exit_code, fmt, ap);
+}
+
+/* append data to the output buffer */
+static void outn(struct option *o, const char *data, size_t len)
+{
+  struct outbuf *out = &o->out;
+  if(out->len + len > out->size) {
+    size_t nsize = out->size ? out->size : OUTBUF_SIZE;
+    char *n;
+    while(nsize < out->len + len)
+      nsize *= 2;
+    n = realloc(out->buf, nsize);
+    if(!n)
+      errorf(o, ERROR_MEM, "out of memory");
+    o->allocs++;
+    out->buf = n;
+    out->size = nsize;
+  }
+  memcpy(&out->buf[out->len], data, len);
+  out->len += len;
+}
+
+static void outs(struct option *o, const char *str)
+{
+  outn(o, str, strlen(str));
+}
+
+static void outc(struct option *o, char c)
+{
+  struct outbuf *out = &o->out;
+  if(out->len < out->size)
+    out->buf[out->len++] = c;
+  else
+    outn(o, &c, 1);
+}
+
+/* write the collected output to stdout, the library keeps it */
+void trurl_outflush(struct option *o)
+{
+  struct outbuf *out = &o->out;
+  if(o->library)
+    return;
+  STAGE(o, STAGE_WRITE);
+  if(out->len) {
+    fwrite(out->buf, 1, out->len, stdout);
+    out->len = 0;
+  }
+  fflush(stdout);
+  STAGE(o, STAGE_OTHER);
+}
+
+uint64_t trurl_nanotime(void)
+{
+#ifdef _WIN32
+  static LARGE_INTEGER freq;
+  LARGE_INTEGER count;
+  if(!freq.QuadPart)
+    QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&count);
+  return (uint64_t)((double)count.QuadPart * 1e9 / (double)freq.QuadPart);
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+/* the time since the previous stage started is added to that stage */
+void trurl_stagestart(struct option *o, enum stage stage)
+{
+  struct stats *s = o->stats;
+  uint64_t now = trurl_nanotime();
+  s->stagetime[s->stage] += now - s->last;
+  s->last = now;
+  s->stage = stage;
+}
+
+/* count a URL the parser did not accept */
+static void failure(struct option *o, CURLUcode rc)
+{
+  o->memoskip = true;
+  if(o->stats)
+    o->stats->failures[((unsigned int)rc < STATS_CODES) ?
+                       rc : STATS_CODES - 1]++;
+}
+
+/*
+ * The latency histogram has logarithmic buckets like HdrHistogram: values
+ * below 16 get a bucket each, above that every power of two range is split
+ * in 8 buckets. That is within 12.5% of the value, over any range.
+ */
+static unsigned int histindex(uint64_t ns)
+{
+  unsigned int bits = 4;
+  if(ns < 16)
+    return (unsigned int)ns;
+  while((ns >> bits) > 1)
+    bits++;
+  /* the three bits below the highest one tell which eighth */
+  return 16 + (bits - 4) * 8 + (unsigned int)((ns >> (bits - 3)) & 7);
+}
+
+/* the lowest value in a bucket */
+static uint64_t histvalue(unsigned int i)
+{
+  if(i < 16)
+    return i;
+  return (uint64_t)(8 + (i - 16) % 8) << ((i - 16) / 8 + 1);
+}
+
+static const char * const stagename[STAGE_LAST] = {
+  "other", "read", "parse", "normalize", "query", "format", "write"
+};
+
+/* --slowest keeps the fastest of the slowest URLs at the top of a heap */
+static void slowdown(struct stats *s, unsigned int i)
+{
+  for(;;) {
+    unsigned int least = i;
+    unsigned int child = 2 * i + 1;
+    struct slowurl tmp;
+    if((child < s->nslow) && (s->slow[child].ns < s->slow[least].ns))
+      least = child;
+    if((child + 1 < s->nslow) && (s->slow[child + 1].ns < s->slow[least].ns))
+      least = child + 1;
+    if(least == i)
+      break;
+    tmp = s->slow[i];
+    s->slow[i] = s->slow[least];
+    s->slow[least] = tmp;
+    i = least;
+  }
+}
+
+static void slowup(struct stats *s, unsigned int i)
+{
+  while(i) {
+    unsigned int parent = (i - 1) / 2;
+    struct slowurl tmp;
+    if(s->slow[parent].ns <= s->slow[i].ns)
+      break;
+    tmp = s->slow[i];
+    s->slow[i] = s->slow[parent];
+    s->slow[parent] = tmp;
+    i = parent;
+  }
+}
+
+static void slowest(struct option *o, const char *url, uint64_t ns,
+                    const uint64_t *before)
+{
+  struct stats *s = o->stats;
+  struct slowurl *e;
+  unsigned int i;
+  char *copy;
+  if((s->nslow == s->maxslow) && (ns <= s->slow[0].ns))
+    return; /* the common case */
+  copy = strdup(url ? url : "");
+  if(!copy)
+    errorf(o, ERROR_MEM, "out of memory");
+  if(s->nslow < s->maxslow)
+    e = &s->slow[s->nslow++];
+  else {
+    /* replace the top */
+    e = &s->slow[0];
+    free(e->url);
+  }
+  e->ns = ns;
+  e->url = copy;
+  for(i = 0; i < STAGE_LAST; i++)
+    e->stagetime[i] = s->stagetime[i] - before[i];
+  if(e == s->slow)
+    slowdown(s, 0);
+  else
+    slowup(s, s->nslow - 1);
+}
+
+/* one URL took this long, 'before' is the stage times before it */
+void trurl_stats_url(struct option *o, const char *url, uint64_t ns,
+                     const uint64_t *before)
+{
+  o->stats->latency[histindex(ns)]++;
+  if(ns > o->stats->maxlatency)
+    o->stats->maxlatency = ns;
+  if(o->stats->maxslow)
+    slowest(o, url, ns, before);
+}
+
+static int slowcmp(const void *a, const void *b)
+{
+  const struct slowurl *x = a;
+  const struct slowurl *y = b;
+  return (x->ns < y->ns) - (x->ns > y->ns); /* slowest first */
+}
+
+/* a JSON string on stderr */
+static void jsonerr(const char *str)
+{
+  fputc('\"', stderr);
+  for(; *str; str++) {
+    unsigned char c = (unsigned char)*str;
+    if((c == '\"') || (c == '\\'))
+      curl_mfprintf(stderr, "\\%c", c);
+    else if(c < 0x20)
+      curl_mfprintf(stderr, "\\u%04x", c);
+    else
+      fputc(c, stderr);
+  }
+  fputc('\"', stderr);
+}
+
+/* --slowest, show the URLs slowest first */
+static void showslowest(struct stats *s)
+{
+  unsigned int i;
+  unsigned int j;
+  qsort(s->slow, s->nslow, sizeof(struct slowurl), slowcmp);
+  if(s->json) {
+    curl_mfprintf(stderr, "[");
+    for(i = 0; i < s->nslow; i++) {
+      curl_mfprintf(stderr, "%s\n    {\n      \"url\": ", i ? "," : "");
+      jsonerr(s->slow[i].url);
+      curl_mfprintf(stderr, ",\n      \"ns\": %" CURL_FORMAT_CURL_OFF_TU
+                    ",\n      \"stage_ns\": {", (curl_off_t)s->slow[i].ns);
+      for(j = 0; j < STAGE_LAST; j++)
+        curl_mfprintf(stderr, "%s\n        \"%s\": %"
+                      CURL_FORMAT_CURL_OFF_TU, j ? "," : "", stagename[j],
+                      (curl_off_t)s->slow[i].stagetime[j]);
+      curl_mfprintf(stderr, "\n      }\n    }");
+    }
+    curl_mfprintf(stderr, "%s]", s->nslow ? "\n  " : "");
+    return;
+  }
+  curl_mfprintf(stderr, "slowest URLs, ns:\n");
+  for(i = 0; i < s->nslow; i++) {
+    curl_mfprintf(stderr, "  %10" CURL_FORMAT_CURL_OFF_TU " [%s]",
+                  (curl_off_t)s->slow[i].ns, s->slow[i].url);
+    for(j = 0; j < STAGE_LAST; j++) {
+      if(s->slow[i].stagetime[j])
+        curl_mfprintf(stderr, " %s %" CURL_FORMAT_CURL_OFF_TU, stagename[j],
+                      (curl_off_t)s->slow[i].stagetime[j]);
+    }
+    curl_mfprintf(stderr, "\n");
+  }
+}
+
+/* the highest value in the bucket holding the given percentile */
+static uint64_t percentile(struct stats *s, uint64_t total, double pct)
+{
+  uint64_t want = (uint64_t)((double)total * pct / 100.0 + 0.5);
+  uint64_t seen = 0;
+  unsigned int i;
+  if(!want)
+    want = 1;
+  for(i = 0; i < STATS_BUCKETS; i++) {
+    seen += s->latency[i];
+    if(seen >= want) {
+      uint64_t high = histvalue(i + 1) - 1;
+      return (high < s->maxlatency) ? high : s->maxlatency;
+    }
+  }
+  return s->maxlatency;
+}
+
+/* peak resident set size in kilobytes, 0 when not known */
+static unsigned long peakrss(void)
+{
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS pmc;
+  if(GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+    return (unsigned long)(pmc.PeakWorkingSetSize / 1024);
+  return 0;
+#else
+  struct rusage ru;
+  if(getrusage(RUSAGE_SELF, &ru))
+    return 0;
+#ifdef __APPLE__
+  return (unsigned long)(ru.ru_maxrss / 1024); /* bytes */
+#else
+  return (unsigned long)ru.ru_maxrss;
+#endif
+#endif
+}
+
+/* --stats, show what happened on stderr */
+void trurl_stats_show(struct option *o)
+{
+  struct stats *s = o->stats;
+  static const double pcts[] = { 50, 90, 99, 99.9 };
+  static const char * const pctname[] = { "p50", "p90", "p99", "p99.9" };
+  uint64_t total = 0;
+  uint64_t failed = 0;
+  const char *sep = "";
+  unsigned int i;
+  STAGE(o, STAGE_OTHER);
+  for(i = 0; i < STATS_BUCKETS; i++)
+    total += s->latency[i];
+  for(i = 0; i < STATS_CODES; i++)
+    failed += s->failures[i];
+
+  if(!s->show) {
+    /* only --slowest */
+    showslowest(s);
+    return;
+  }
+  if(s->json) {
+    curl_mfprintf(stderr, "{\n  \"urls_in\": %" CURL_FORMAT_CURL_OFF_TU
+                  ",\n  \"urls_out\": %" CURL_FORMAT_CURL_OFF_TU
+                  ",\n  \"parse_failures\": {",
+                  (curl_off_t)s->in, (curl_off_t)s->out);
+    for(i = 0; i < STATS_CODES; i++) {
+      if(s->failures[i]) {
+        curl_mfprintf(stderr, "%s\n    \"%u\": %" CURL_FORMAT_CURL_OFF_TU,
+                      sep, i, (curl_off_t)s->failures[i]);
+        sep = ",";
+      }
+    }
+    curl_mfprintf(stderr, "%s},\n  \"stage_ns\": {", *sep ? "\n  " : "");
+    for(i = 0; i < STAGE_LAST; i++)
+      curl_mfprintf(stderr, "%s\n    \"%s\": %" CURL_FORMAT_CURL_OFF_TU,
+                    i ? "," : "", stagename[i],
+                    (curl_off_t)s->stagetime[i]);
+    curl_mfprintf(stderr, "\n  },\n  \"latency_ns\": {");
+    for(i = 0; i < sizeof(pcts) / sizeof(pcts[0]); i++)
+      curl_mfprintf(stderr, "\n    \"%s\": %" CURL_FORMAT_CURL_OFF_TU ",",
+                    pctname[i], (curl_off_t)percentile(s, total, pcts[i]));
+    curl_mfprintf(stderr, "\n    \"max\": %" CURL_FORMAT_CURL_OFF_TU
+                  ",\n    \"histogram\": [", (curl_off_t)s->maxlatency);
+    sep = "";
+    for(i = 0; i < STATS_BUCKETS; i++) {
+      if(s->latency[i]) {
+        curl_mfprintf(stderr, "%s\n      [%" CURL_FORMAT_CURL_OFF_TU
+                      ", %" CURL_FORMAT_CURL_OFF_TU ", %"
+                      CURL_FORMAT_CURL_OFF_TU "]", sep,
+                      (curl_off_t)histvalue(i),
+                      (curl_off_t)histvalue(i + 1) - 1,
+                      (curl_off_t)s->latency[i]);
+        sep = ",";
+      }
+    }
+    curl_mfprintf(stderr, "%s]\n  },\n", *sep ? "\n    " : "");
+    if(s->maxslow) {
+      curl_mfprintf(stderr, "  \"slowest\": ");
+      showslowest(s);
+      curl_mfprintf(stderr, ",\n");
+    }
+    curl_mfprintf(stderr, "  \"idn_cache\": {\"hits\": %"
+                  CURL_FORMAT_CURL_OFF_TU ", \"misses\": %"
+                  CURL_FORMAT_CURL_OFF_TU "},\n",
+                  (curl_off_t)(o->idn ? o->idn->hits : 0),
+                  (curl_off_t)(o->idn ? o->idn->misses : 0));
+    curl_mfprintf(stderr, "  \"peak_rss_kb\": %lu\n}\n", peakrss());
+    return;
+  }
+
+  curl_mfprintf(stderr, "URLs in: %" CURL_FORMAT_CURL_OFF_TU ", out: %"
+                CURL_FORMAT_CURL_OFF_TU ", parse failures: %"
+                CURL_FORMAT_CURL_OFF_TU "\n", (curl_off_t)s->in,
+                (curl_off_t)s->out, (curl_off_t)failed);
+  for(i = 0; i < STATS_CODES; i++) {
+    if(s->failures[i])
+      curl_mfprintf(stderr, "  %" CURL_FORMAT_CURL_OFF_TU " %s (%u)\n",
+                    (curl_off_t)s->failures[i],
+                    curl_url_strerror((CURLUcode)i), i);
+  }
+  curl_mfprintf(stderr, "time per stage, ms:");
+  for(i = 0; i < STAGE_LAST; i++)
+    curl_mfprintf(stderr, " %s %.3f", stagename[i],
+                  (double)s->stagetime[i] / 1e6);
+  curl_mfprintf(stderr, "\nlatency per URL, ns:");
+  for(i = 0; i < sizeof(pcts) / sizeof(pcts[0]); i++)
+    curl_mfprintf(stderr, " %s %" CURL_FORMAT_CURL_OFF_TU, pctname[i],
+                  (curl_off_t)percentile(s, total, pcts[i]));
+  curl_mfprintf(stderr, " max %" CURL_FORMAT_CURL_OFF_TU "\n",
+                (curl_off_t)s->maxlatency);
+  for(i = 0; i < STATS_BUCKETS; i++) {
+    if(s->latency[i])
+      curl_mfprintf(stderr, "  %10" CURL_FORMAT_CURL_OFF_TU " - %10"
+                    CURL_FORMAT_CURL_OFF_TU ": %" CURL_FORMAT_CURL_OFF_TU
+                    "\n", (curl_off_t)histvalue(i),
+                    (curl_off_t)histvalue(i + 1) - 1,
+                    (curl_off_t)s->latency[i]);
+  }
+  if(o->idn)
+    curl_mfprintf(stderr, "IDN cache: %" CURL_FORMAT_CURL_OFF_TU " hits, %"
+                  CURL_FORMAT_CURL_OFF_TU " misses\n",
+                  (curl_off_t)o->idn->hits, (curl_off_t)o->idn->misses);
+  curl_mfprintf(stderr, "peak RSS: %lu kB\n", peakrss());
+  if(s->maxslow)
+    showslowest(s);
+}
+
+void trurl_json_begin(struct option *o)
+{
+  if(o->jsonout)
+    outc(o, '[');
+}
+
+void trurl_json_end(struct option *o)
+{
+  if(o->jsonout)
+    outs(o, o->urls ? "\n]\n" : "]\n");
+}
+
+/* the library always behaves as if --verify was used */
+static void verify(struct option *o, int exit_code, const char *fmt, ...)
+{
+  va_list ap;
+  va_start(ap, fmt);
+  if(!o->verify && !o->jmp) {
+    warnf_low(o, fmt, ap);
+    va_end(ap);
+  }
+  else {
+    /* make sure to terminate the JSON array */
+    if(!o->jmp)
+      trurl_json_end(o);
+    errorv(o, exit_code, fmt, ap);
+  }
+}
+
+static void urladd(struct option *o, const char *url)
+{
+  struct curl_slist *n;
+  n = curl_slist_append(o->url_list, url);
+  if(n)
+    o->url_list = n;
+}
+
+/* read URLs from this file/stdin */
+static void urlfile(struct option *o, const char *file)
+{
+  FILE *f;
+  if(o->url)
+    errorf(o, ERROR_FLAG, "only one --url-file is supported");
+  if(strcmp("-", file)) {
+    f = fopen(file, "rt");
+    if(!f)
+      errorf(o, ERROR_FILE, "--url-file %s not found", file);
+    o->urlopen = true;
+  }
+  else
+    f = stdin;
+  o->url = f;
+}
+
+static void pathadd(struct option *o, const char *path)
+{
+  struct curl_slist *n;
+  char *urle = curl_easy_escape(NULL, path, 0);
+  if(urle) {
+    n = curl_slist_append(o->append_path, urle);
+    if(n) {
+      o->append_path = n;
+    }
+    curl_free(urle);
+  }
+}
+
+static char *encodeassign(const char *query)
+{
+  const char *p = strchr(query, '=');
+  char *urle;
+  if(p) {
+    /* URL encode the left and the right side of the '=' separately */
+    char *f1 = curl_easy_escape(NULL, query, (int)(p - query));
+    char *f2 = curl_easy_escape(NULL, p + 1, 0);
+    urle = curl_maprintf("%s=%s", f1, f2);
+    curl_free(f1);
+    curl_free(f2);
+  }
+  else
+    urle = curl_easy_escape(NULL, query, 0);
+  return urle;
+}
+
+static void queryadd(struct option *o, const char *query)
+{
+  char *urle = encodeassign(query);
+  if(urle) {
+    struct curl_slist *n = curl_slist_append(o->append_query, urle);
+    if(n)
+      o->append_query = n;
+    curl_free(urle);
+  }
+}
+
+static void appendadd(struct option *o, const char *arg)
+{
+  if(!strncmp("path=", arg, 5))
+    pathadd(o, arg + 5);
+  else if(!strncmp("query=", arg, 6))
+    queryadd(o, arg + 6);
+  else
+    errorf(o, ERROR_APPEND, "--append unsupported component: %s", arg);
+}
+
+static void setadd(struct option *o, const char *set) /* [component]=[data] */
+{
+  struct curl_slist *n;
+  n = curl_slist_append(o->set_list, set);
+  if(n)
+    o->set_list = n;
+}
+
+static void iteradd(struct option *o,
+                    const char *iter, /* [component]=[data] */
+                    bool fromfile)
+{
+  struct iterinfo *n = realloc(o->iters,
+                               (o->niters + 1) * sizeof(struct iterinfo));
+  if(!n)
+    errorf(o, ERROR_MEM, "out of memory");
+  o->iters = n;
+  n = &o->iters[o->niters++];
+  memset(n, 0, sizeof(*n));
+  n->arg = iter;
+  n->fromfile = fromfile;
+}
+
+static void trimadd(struct option *o,
+                    const char *trim) /* [component]=[data] */
+{
+  struct curl_slist *n;
+  n = curl_slist_append(o->trim_list, trim);
+  if(n)
+    o->trim_list = n;
+}
+
+static void replaceadd(struct option *o,
+                       const char *replace_list) /* [component]=[data] */
+{
+  if(replace_list) {
+    char *urle = encodeassign(replace_list);
+    if(urle) {
+      struct curl_slist *n = curl_slist_append(o->replace_list, urle);
+      if(n)
+        o->replace_list = n;
+      curl_free(urle);
+    }
+  }
+  else
+    errorf(o, ERROR_REPL, "No data passed to replace component");
+}
+
+static bool longarg(const char *flag, const char *check)
+{
+  /* the given flag might end with an equals sign */
+  size_t len = strlen(flag);
+  return (!strcmp(flag, check) ||
+          (!strncmp(flag, check, len) && check[len] == '='));
+}
+
+static bool checkoptarg(struct option *o, const char *flag,
+                        const char *given,
+                        const char *arg)
+{
+  bool shortopt = false;
+  if((flag[0] == '-') && (flag[1] != '-'))
+    shortopt = true;
+  if((!shortopt && longarg(flag, given)) ||
+     (!strncmp(flag, given, 2) && shortopt)) {
+    if(!arg)
+      errorf(o, ERROR_ARG, "Missing argument for %s", flag);
+    return true;
+  }
+  return false;
+}
+
+static void statsinit(struct option *o)
+{
+  if(!o->stats) {
+    o->stats = calloc(1, sizeof(struct stats));
+    if(!o->stats)
+      errorf(o, ERROR_MEM, "out of memory");
+    o->stats->last = trurl_nanotime();
+  }
+}
+
+static void uniqueinit(struct option *o)
+{
+  if(o->jsonout)
+    errorf(o, ERROR_FLAG, "--json is mutually exclusive with --unique");
+  if(!o->unique) {
+    o->unique = calloc(1, sizeof(struct uniqset));
+    if(!o->unique)
+      errorf(o, ERROR_MEM, "out of memory");
+  }
+}
+
+/* a number of bytes with an optional k, m or g suffix, 0 if it is not or
+   if it is not below MAX_BYTES */
+#define MAX_BYTES (1ULL << 40)
+static unsigned long long getbytes(const char *arg, char **end)
+{
+  unsigned long long bytes = strtoull(arg, end, 10);
+  unsigned int shift = 0;
+  if((*arg < '0') || (*arg > '9'))
+    return 0;
+  switch(**end) {
+  case 'g':
+  case 'G':
+    shift = 30;
+    break;
+  case 'm':
+  case 'M':
+    shift = 20;
+    break;
+  case 'k':
+  case 'K':
+    shift = 10;
+    break;
+  }
+  if(shift)
+    (*end)++;
+  /* checked before the shift, so that it cannot wrap around */
+  if(bytes >= (MAX_BYTES >> shift))
+    return 0;
+  return bytes << shift;
+}
+
+/* --unique-approx [bytes],[false positive rate] */
+static void bloominit(struct option *o, const char *arg)
+{
+  struct uniqset *u = o->unique;
+  char *end;
+  unsigned long long bytes = getbytes(arg, &end);
+  double p;
+  double x = 0.5;
+  if((*arg < '0') || (*arg > '9') || (*end != ',') ||
+     (bytes < BLOOM_BLOCK) || (bytes > ((size_t)-1 / 2)) ||
+     (bytes / BLOOM_BLOCK > 0xffffffff))
+    errorf(o, ERROR_FLAG, "--unique-approx needs [bytes],[rate], at least "
+           "%u bytes", BLOOM_BLOCK);
+  arg = end + 1;
+  p = strtod(arg, &end);
+  if((end == arg) || *end || !(p > 0) || (p > 0.5))
+    errorf(o, ERROR_FLAG, "--unique-approx rate must be above 0 and at "
+           "most 0.5");
+  /* the optimal number of bits per output is log2(1/p) */
+  u->k = 1;
+  while((x > p) && (u->k < 32)) {
+    x /= 2;
+    u->k++;
+  }
+  u->fprate = p;
+  u->blocks = bytes / BLOOM_BLOCK;
+  u->bloom = calloc((size_t)u->blocks, BLOOM_BLOCK);
+  if(!u->bloom)
+    errorf(o, ERROR_MEM, "out of memory");
+}
+
+/*
+ * --memo keeps the output of the input lines in a hash table with an entry
+ * per MEMO_AVERAGE bytes, and evicts with CLOCK when the entries or the
+ * bytes run out. A line with a note or a failure is not kept, so that
+ * repeating it says it again.
+ */
+#define MEMO_AVERAGE 256 /* bytes per entry, the line and its output */
+#define MEMO_MIN 16384
+
+static void memoinit(struct option *o, const char *arg)
+{
+  struct memo *m;
+  char *end;
+  unsigned long long bytes = getbytes(arg, &end);
+  size_t tables;
+  uint32_t i;
+  if(o->memo)
+    errorf(o, ERROR_FLAG, "only one --memo is supported");
+  if(*end || (bytes < MEMO_MIN) || (bytes > ((size_t)-1 / 2)))
+    errorf(o, ERROR_FLAG, "--memo needs a size of at least %u bytes",
+           MEMO_MIN);
+  m = o->memo = calloc(1, sizeof(struct memo));
+  if(!m)
+    errorf(o, ERROR_MEM, "out of memory");
+  m->size = (size_t)bytes;
+  m->nentries = 64;
+  while((m->nentries < 0x80000000) &&
+        ((unsigned long long)m->nentries * 2 * MEMO_AVERAGE <= bytes))
+    m->nentries *= 2;
+  m->entry = calloc(m->nentries, sizeof(struct memoentry));
+  m->bucket = calloc(m->nentries, sizeof(uint32_t));
+  if(!m->entry || !m->bucket)
+    errorf(o, ERROR_MEM, "out of memory");
+  for(i = 0; i < m->nentries; i++)
+    m->entry[i].chain = (i + 2 <= m->nentries) ? i + 2 : 0;
+  m->free = 1;
+  tables = m->nentries * (sizeof(struct memoentry) + sizeof(uint32_t));
+  m->maxbytes = (m->size > tables) ? m->size - tables : 0;
+}
+
+/* --exclude-hosts and --only-hosts, the file is loaded after the options */
+static struct hostlist *hostsnew(struct option *o, struct hostlist *l,
+                                 const char *flag, const char *file)
+{
+  if(l)
+    errorf(o, ERROR_FLAG, "only one %s is supported", flag);
+  l = calloc(1, sizeof(struct hostlist));
+  if(!l)
+    errorf(o, ERROR_MEM, "out of memory");
+  l->flag = flag;
+  l->file = file;
+  return l;
+}
+
+/* --cardinality, a sketch for each component in the list */
+static void cardinalityinit(struct option *o, const char *arg)
+{
+  struct cardinality *c = calloc(1, sizeof(struct cardinality));
+  size_t n = 1;
+  const char *p;
+  char *name;
+  if(!c)
+    errorf(o, ERROR_MEM, "out of memory");
+  o->cardinality = c;
+  for(p = arg; *p; p++)
+    if(*p == ',')
+      n++;
+  c->names = strdup(arg);
+  c->sketch = calloc(n, sizeof(struct sketch));
+  if(!c->names || !c->sketch)
+    errorf(o, ERROR_MEM, "out of memory");
+  name = c->names;
+  while(name) {
+    struct sketch *s = &c->sketch[c->nsketches];
+    char *comma = strchr(name, ',');
+    if(comma)
+      *comma++ = 0;
+    if(!*name)
+      errorf(o, ERROR_FLAG, "--cardinality needs a list of components");
+    s->name = name;
+    c->nsketches++;
+    if(strcmp(name, "query-keys")) {
+      /* a component name or a --get format */
+      s->format = strchr(name, '{') ?
+        curl_maprintf("%s", name) : curl_maprintf("{%s}", name);
+      if(!s->format)
+        errorf(o, ERROR_MEM, "out of memory");
+    }
+    name = comma;
+  }
+}
+
+static int getarg(struct option *o,
+                  const char *flag,
+                  const char *arg,
+                  bool *usedarg)
+{
+  bool gap = true;
+  *usedarg = false;
+
+  if((flag[0] == '-') && (flag[1] != '-') && flag[2]) {
+    arg = (const char *)&flag[2];
+    gap = false;
+  }
+  else if((flag[0] == '-') && (flag[1] == '-')) {
+    const char *equals = strchr(&flag[2], '=');
+    if(equals) {
+      arg = (const char *)&equals[1];
+      gap = false;
+    }
+  }
+
+  if(o->library &&
+     (!strcmp("-v", flag) || !strcmp("--version", flag) ||
+      !strcmp("-h", flag) || !strcmp("--help", flag) ||
+      !strncmp("-f", flag, 2) || longarg(flag, "--url-file") ||
+      longarg(flag, "--url") || !strcmp("--server", flag) ||
+      longarg(flag, "--listen") || longarg(flag, "--workers") ||
+      !strncmp("--stats", flag, 7) || longarg(flag, "--progress") ||
+      longarg(flag, "--slowest") || !strncmp("--unique", flag, 8) ||
+      longarg(flag, "--count-by") || longarg(flag, "--top") ||
+      longarg(flag, "--cardinality") || longarg(flag, "--compile-hosts") ||
+      longarg(flag, "--memo")))
+    errorf(o, ERROR_FLAG, "%s is not supported by the library", flag);
+
+  if(!strcmp("--", flag))
+    o->end_of_options = true;
+  else if(!strcmp("-v", flag) || !strcmp("--version", flag))
+    show_version();
+  else if(!strcmp("-h", flag) || !strcmp("--help", flag))
+    help();
+  else if(checkoptarg(o, "--url", flag, arg)) {
+    urladd(o, arg);
+    *usedarg = gap;
+  }
+  else if(checkoptarg(o, "-f", flag, arg) ||
+          checkoptarg(o, "--url-file", flag, arg)) {
+    urlfile(o, arg);
+    *usedarg = gap;
+  }
+  else if(checkoptarg(o, "-a", flag, arg) ||
+          checkoptarg(o, "--append", flag, arg)) {
+    appendadd(o, arg);
+    *usedarg = gap;
+  }
+  else if(checkoptarg(o, "-s", flag, arg) ||
+          checkoptarg(o, "--set", flag, arg)) {
+    setadd(o, arg);
+    *usedarg = gap;
+  }
+  else if(checkoptarg(o, "--iterate", flag, arg)) {
+    iteradd(o, arg, false);
+    *usedarg = gap;
+  }
+  else if(checkoptarg(o, "--iterate-file", flag, arg)) {
+    iteradd(o, arg, true);
+    *usedarg = gap;
+  }
+  else if(checkoptarg(o, "--redirect", flag, arg)) {
+    if(o->redirect)
+      errorf(o, ERROR_FLAG, "only one --redirect is supported");
+    o->redirect = arg;
+    *usedarg = gap;
+  }
+  else if(checkoptarg(o, "--query-separator", flag, arg)) {
+    if(o->qsep)
+      errorf(o, ERROR_FLAG, "only one --query-separator is supported");
+    if(strlen(arg) != 1)
+      errorf(o, ERROR_FLAG,
+             "only single-letter query separators are supported");
+    o->qsep = arg;
+    *usedarg = gap;
+  }
+  else if(checkoptarg(o, "--trim", flag, arg)) {
+    if(strncmp(arg, "query=", 6))
+      errorf(o, ERROR_TRIM, "Unsupported trim component: %s", arg);
+
+    trimadd(o, &arg[6]);
+    *usedarg = gap;
+  }
+  else if(checkoptarg(o, "--qtrim", flag, arg)) {
+    trimadd(o, arg);
+    *usedarg = gap;
+  }
+  else if(checkoptarg(o, "-g", flag, arg) ||
+          checkoptarg(o, "--get", flag, arg)) {
+    if(o->format)
+      errorf(o, ERROR_FLAG, "only one --get is supported");
+    if(o->jsonout)
+      errorf(o, ERROR_FLAG, "--get is mutually exclusive with --json");
+    if(o->countby)
+      errorf(o, ERROR_FLAG, "--get is mutually exclusive with --count-by");
+    o->format = arg;
+    *usedarg = gap;
+  }
+  else if(!strcmp("--json", flag)) {
+    if(o->format)
+      errorf(o, ERROR_FLAG, "--json is mutually exclusive with --get");
+    if(o->unique)
+      errorf(o, ERROR_FLAG, "--json is mutually exclusive with --unique");
+    o->jsonout = true;
+  }
+  else if(!strcmp("--unique", flag) || !strcmp("--unique-exact", flag)) {
+    uniqueinit(o);
+    if(o->unique->bloom)
+      errorf(o, ERROR_FLAG, "--unique-approx is mutually exclusive with "
+             "--unique");
+    o->unique->plain = true;
+    if(flag[8])
+      o->unique->exact = true;
+  }
+  else if(checkoptarg(o, "--unique-approx", flag, arg)) {
+    uniqueinit(o);
+    if(o->unique->plain || o->unique->bloom)
+      errorf(o, ERROR_FLAG, "--unique-approx is mutually exclusive with "
+             "--unique");
+    bloominit(o, arg);
+    *usedarg = gap;
+  }
+  else if(checkoptarg(o, "--count-by", flag, arg)) {
+    if(o->countby)
+      errorf(o, ERROR_FLAG, "only one --count-by is supported");
+    if(o->format)
+      errorf(o, ERROR_FLAG, "--get is mutually exclusive with --count-by");
+    o->countby = arg;
+    *usedarg = gap;
+  }
+  else if(checkoptarg(o, "--where", flag, arg)) {
+    if(o->whereexpr)
+      errorf(o, ERROR_FLAG, "only one --where is supported");
+    o->whereexpr = arg;
+    *usedarg = gap;
+  }
+  else if(checkoptarg(o, "--exclude-hosts", flag, arg)) {
+    o->exclude = hostsnew(o, o->exclude, "--exclude-hosts", arg);
+    *usedarg = gap;
+  }
+  else if(checkoptarg(o, "--only-hosts", flag, arg)) {
+    o->only = hostsnew(o, o->only, "--only-hosts", arg);
+    *usedarg = gap;
+  }
+  else if(checkoptarg(o, "--memo", flag, arg)) {
+    memoinit(o, arg);
+    *usedarg = gap;
+  }
+  else if(checkoptarg(o, "--psl", flag, arg)) {
+    if(o->pslfile)
+      errorf(o, ERROR_FLAG, "only one --psl is supported");
+    o->pslfile = arg;
+    *usedarg = gap;
+  }
+  else if(checkoptarg(o, "--where-ip", flag, arg)) {
+    if(o->whereip)
+      errorf(o, ERROR_FLAG, "only one --where-ip is supported");
+    o->whereip = arg;
+    *usedarg = gap;
+  }
+  else if(checkoptarg(o, "--compile-hosts", flag, arg)) {
+    if(o->compilehosts)
+      errorf(o, ERROR_FLAG, "only one --compile-hosts is supported");
+    o->compilehosts = arg;
+    *usedarg = gap;
+  }
+  else if(checkoptarg(o, "--cardinality", flag, arg)) {
+    if(o->cardinality)
+      errorf(o, ERROR_FLAG, "only one --cardinality is supported");
+    cardinalityinit(o, arg);
+    *usedarg = gap;
+  }
+  else if(checkoptarg(o, "--top", flag, arg)) {
+    char *end;
+    unsigned long num = strtoul(arg, &end, 10);
+    if(*end || !num || (num > MAX_TOP) || (*arg < '0') || (*arg > '9'))
+      errorf(o, ERROR_FLAG, "--top must be 1 - %u", MAX_TOP);
+    o->top = num;
+    *usedarg = gap;
+  }
+  else if(checkoptarg(o, "--unique-state", flag, arg)) {
+    uniqueinit(o);
+    o->unique->state = arg;
+    *usedarg = gap;
+  }
+  else if(!strcmp("--verify", flag))
+    o->verify = true;
+  else if(!strcmp("--alloc-stats", flag))
+    o->alloc_stats = true;
+  else if(!strcmp("--server", flag))
+    o->server = true;
+  else if(!strcmp("--stats", flag) || !strcmp("--stats-json", flag)) {
+    statsinit(o);
+    o->stats->show = true;
+    if(flag[7])
+      o->stats->json = true;
+  }
+  else if(checkoptarg(o, "--slowest", flag, arg)) {
+    char *end;
+    unsigned long num = strtoul(arg, &end, 10);
+    if(*end || !num || (num > MAX_SLOWEST) || (*arg < '0') || (*arg > '9'))
+      errorf(o, ERROR_FLAG, "--slowest must be 1 - %u", MAX_SLOWEST);
+    statsinit(o);
+    if(o->stats->maxslow)
+      errorf(o, ERROR_FLAG, "only one --slowest is supported");
+    o->stats->slow = calloc(num, sizeof(struct slowurl));
+    if(!o->stats->slow)
+      errorf(o, ERROR_MEM, "out of memory");
+    o->stats->maxslow = (unsigned int)num;
+    *usedarg = gap;
+  }
+  else if(checkoptarg(o, "--listen", flag, arg)) {
+    if(o->listen)
+      errorf(o, ERROR_FLAG, "only one --listen is supported");
+    o->listen = arg;
+    *usedarg = gap;
+  }
+  else if(checkoptarg(o, "--progress", flag, arg)) {
+    char *end;
+    unsigned long num = strtoul(arg, &end, 10);
+    if(*end || !num || (num > MAX_PROGRESS) || (*arg < '0') || (*arg > '9'))
+      errorf(o, ERROR_FLAG, "--progress must be 1 - %u seconds",
+             MAX_PROGRESS);
+    o->progress = (unsigned int)num;
+    *usedarg = gap;
+  }
+  else if(checkoptarg(o, "--workers", flag, arg)) {
+    char *end;
+    unsigned long num = strtoul(arg, &end, 10);
+    if(*end || !num || (num > MAX_WORKERS) || (*arg < '0') || (*arg > '9'))
+      errorf(o, ERROR_FLAG, "--workers must be 1 - %u", MAX_WORKERS);
+    o->workers = (unsigned int)num;
+    *usedarg = gap;
+  }
+  else if(!strcmp("--accept-space", flag)) {
+#ifdef SUPPORTS_ALLOW_SPACE
+    o->accept_space = true;
+#else
+    trurl_warnf(o,
+      "built with too old libcurl version, --accept-space does not work");
+#endif
+  }
+  else if(!strcmp("--curl", flag))
+    o->curl = true;
+  else if(!strcmp("--default-port", flag))
+    o->default_port = true;
+  else if(!strcmp("--keep-port", flag))
+    o->keep_port = true;
+  else if(!strcmp("--punycode", flag)) {
+    if(o->puny2idn)
+      errorf(o, ERROR_FLAG, "--punycode is mutually exclusive with --as-idn");
+    o->punycode = true;
+  }
+  else if(!strcmp("--as-idn", flag)) {
+    if(o->punycode)
+      errorf(o, ERROR_FLAG, "--as-idn is mutually exclusive with --punycode");
+    o->puny2idn = true;
+  }
+  else if(!strcmp("--no-guess-scheme", flag))
+    o->no_guess_scheme = true;
+  else if(!strcmp("--sort-query", flag))
+    o->sort_query = true;
+  else if(!strcmp("--urlencode", flag))
+    o->urlencode = true;
+  else if(!strcmp("--quiet", flag))
+    o->quiet_warnings = true;
+  else if(!strcmp("--replace", flag)) {
+    replaceadd(o, arg);
+    *usedarg = gap;
+  }
+  else if(!strcmp("--replace-append", flag) ||
+          !strcmp("--force-replace", flag)) { /* the initial name */
+    replaceadd(o, arg);
+    o->force_replace = true;
+    *usedarg = gap;
+  }
+  else
+    return 1; /* unrecognized option */
+  return 0;
+}
+
+/* for --unique, --count-by, --cardinality and the host lists */
+static uint64_t hash64(const char *data, size_t len)
+{
+  const uint64_t m = 0x9e3779b97f4a7c15;
+  uint64_t h = len * m;
+  while(len >= 8) {
+    uint64_t v;
+    memcpy(&v, data, 8);
+    h = (h ^ v) * m;
+    h ^= h >> 32;
+    data += 8;
+    len -= 8;
+  }
+  if(len) {
+    uint64_t v = 0;
+    memcpy(&v, data, len);
+    h = (h ^ v) * m;
+  }
+  /* the murmur3 finalizer mixes all bits into the low ones */
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccd;
+  h ^= h >> 33;
+  h *= 0xc4ceb93fe53a6ed3;
+  h ^= h >> 33;
+  return h ? h : 1; /* 0 marks a free slot */
+}
+
+/*
+ * --exclude-hosts and --only-hosts. A host matches when it or one of its
+ * parent domains is in the list, which takes a hash table lookup per label
+ * of the host whatever the size of the list. A list saved with
+ * --compile-hosts is the table and the labels just like they are in
+ * memory, so that loading it is a single mmap().
+ */
+#define HOSTS_MAGIC "trurlht1"
+#define HOSTS_HEADER 32 /* magic, byte order, nodes, slots, labels length */
+#define HOSTS_ORDER 0x01020304 /* reads differently on another machine */
+#define HOSTS_SLOTS 1024 /* initial table size */
+#define MAX_HOST_LINE 1024
+#define MAX_LABEL 255
+
+/* the slot with this label below 'parent', or the free slot where it goes */
+static size_t hostslot(const struct hostlist *l, uint32_t parent,
+                       const char *label, size_t len)
+{
+  size_t mask = l->nslots - 1;
+  uint64_t h = hash64(label, len) ^ (parent * 0x9e3779b97f4a7c15);
+  size_t n = (size_t)(h ^ (h >> 32)) & mask;
+  while(l->slot[n].node) {
+    const struct hostnode *e = &l->slot[n];
+    if((e->parent == parent) && (e->len == len) &&
+       (e->label + len <= l->labelslen) &&
+       !memcmp(&l->labels[e->label], label, len))
+      break;
+    n = (n + 1) & mask;
+  }
+  return n;
+}
+
+static void hostsgrow(struct option *o, struct hostlist *l)
+{
+  size_t nslots = l->nslots ? l->nslots * 2 : HOSTS_SLOTS;
+  struct hostnode *old = l->slot;
+  size_t oldslots = l->nslots;
+  size_t i;
+  l->slot = calloc(nslots, sizeof(struct hostnode));
+  if(!l->slot)
+    errorf(o, ERROR_MEM, "out of memory");
+  l->nslots = nslots;
+  for(i = 0; i < oldslots; i++) {
+    if(old[i].node)
+      l->slot[hostslot(l, old[i].parent, &l->labels[old[i].label],
+                       old[i].len)] = old[i];
+  }
+  free(old);
+}
+
+/* add a lowercase domain name, its labels are checked already */
+static void hostadd(struct option *o, struct hostlist *l, const char *name,
+                    size_t len, unsigned char flags)
+{
+  uint32_t parent = 0;
+  size_t n = 0;
+  while(len) {
+    size_t start = len;
+    size_t llen;
+    while(start && (name[start - 1] != '.'))
+      start--;
+    llen = len - start;
+    if((l->nodes + 1) * 10 >= l->nslots * 7)
+      hostsgrow(o, l);
+    n = hostslot(l, parent, &name[start], llen);
+    if(!l->slot[n].node) {
+      struct hostnode *e = &l->slot[n];
+      if(l->labelslen + llen > l->labelssize) {
+        size_t nsize = l->labelssize ? l->labelssize * 2 : OUTBUF_SIZE;
+        char *p;
+        if(nsize > UINT32_MAX)
+          errorf(o, ERROR_FILE, "%s %s: too many hosts", l->flag, l->file);
+        p = realloc(l->labels, nsize);
+        if(!p)
+          errorf(o, ERROR_MEM, "out of memory");
+        l->labels = p;
+        l->labelssize = nsize;
+      }
+      memcpy(&l->labels[l->labelslen], &name[start], llen);
+      e->parent = parent;
+      e->node = l->nodes++;
+      e->label = (uint32_t)l->labelslen;
+      e->len = (unsigned char)llen;
+      l->labelslen += llen;
+    }
+    parent = l->slot[n].node;
+    len = start ? start - 1 : 0;
+  }
+  l->slot[n].end |= flags;
+}
+
+/*
+ * {ipclass} and --where-ip work on the binary address of an IP address
+ * host. All addresses are 128 bits, with IPv4 as IPv4-mapped IPv6, and the
+ * prefixes are kept in a path compressed binary radix tree. The longest
+ * prefix that contains an address decides its class and what --where-ip
+ * does with it.
+ */
+#define IP_LINE 256
+
+/* the special-purpose ranges, the rest is "public" */
+static const char *const ipclasses[] = {
+  "::/0", "public",
+  "::ffff:0.0.0.0/96", "public",
+  "::ffff:0.0.0.0/104", "reserved",
+  "::ffff:10.0.0.0/104", "private",
+  "::ffff:100.64.0.0/106", "shared",
+  "::ffff:127.0.0.0/104", "loopback",
+  "::ffff:169.254.0.0/112", "link-local",
+  "::ffff:172.16.0.0/108", "private",
+  "::ffff:192.0.0.0/120", "reserved",
+  "::ffff:192.0.2.0/120", "documentation",
+  "::ffff:192.168.0.0/112", "private",
+  "::ffff:198.18.0.0/111", "benchmarking",
+  "::ffff:198.51.100.0/120", "documentation",
+  "::ffff:203.0.113.0/120", "documentation",
+  "::ffff:224.0.0.0/100", "multicast",
+  "::ffff:240.0.0.0/100", "reserved",
+  "::ffff:255.255.255.255/128", "broadcast",
+  "::/128", "reserved",
+  "::1/128", "loopback",
+  "100::/64", "reserved",
+  "2001:db8::/32", "documentation",
+  "fc00::/7", "private",
+  "fe80::/10", "link-local",
+  "ff00::/8", "multicast",
+  NULL
+};
+
+static bool parseipv4(const char *s, size_t len, unsigned char *out)
+{
+  size_t i = 0;
+  int part;
+  for(part = 0; part < 4; part++) {
+    unsigned int num = 0;
+    size_t digits = 0;
+    if(part) {
+      if((i == len) || (s[i] != '.'))
+        return false;
+      i++;
+    }
+    while((i < len) && ISDIGIT(s[i]) && (digits < 3)) {
+      num = num * 10 + (unsigned int)(s[i++] - '0');
+      digits++;
+    }
+    if(!digits || (num > 255))
+      return false;
+    out[part] = (unsigned char)num;
+  }
+  return i == len;
+}
+
+static bool parseipv6(const char *s, size_t len, unsigned char *out)
+{
+  unsigned int words[8];
+  size_t n = 0;
+  size_t gap = 8; /* where the :: is, 8 when there is none */
+  size_t i = 0;
+  if((len >= 2) && (s[0] == ':') && (s[1] == ':')) {
+    gap = 0;
+    i = 2;
+  }
+  while(i < len) {
+    unsigned int word = 0;
+    size_t digits = 0;
+    if(!memchr(&s[i], ':', len - i) && memchr(&s[i], '.', len - i)) {
+      /* an IPv4 address at the end */
+      unsigned char v4[4];
+      if((n > 6) || !parseipv4(&s[i], len - i, v4))
+        return false;
+      words[n++] = (unsigned int)(v4[0] << 8 | v4[1]);
+      words[n++] = (unsigned int)(v4[2] << 8 | v4[3]);
+      break;
+    }
+    while((i < len) && ISXDIGIT(s[i]) && (digits < 4)) {
+      word = word * 16 + (unsigned int)(ISDIGIT(s[i]) ? s[i] - '0' :
+                                        (s[i] | ('a' - 'A')) - 'a' + 10);
+      i++;
+      digits++;
+    }
+    if(!digits || (n == 8))
+      return false;
+    words[n++] = word;
+    if(i == len)
+      break;
+    if((s[i++] != ':') || (i == len))
+      return false;
+    if(s[i] == ':') {
+      if(gap != 8)
+        return false;
+      gap = n;
+      i++;
+    }
+  }
+  if((gap == 8) ? (n != 8) : (n > 7))
+    return false;
+  memset(out, 0, 16);
+  for(i = 0; i < n; i++) {
+    /* the words after the :: go to the end */
+    size_t pos = (i < gap) ? i : 8 - n + i;
+    out[pos * 2] = (unsigned char)(words[i] >> 8);
+    out[pos * 2 + 1] = (unsigned char)(words[i] & 0xff);
+  }
+  return true;
+}
+
+/* an IP address host name, with or without brackets and zone id */
+static bool hostaddr(const char *host, size_t len, unsigned char *addr)
+{
+  if(len && (host[0] == '[')) {
+    const char *zone;
+    if(host[len - 1] != ']')
+      return false;
+    host++;
+    len -= 2;
+    zone = memchr(host, '%', len);
+    if(zone)
+      len = zone - host;
+    return parseipv6(host, len, addr);
+  }
+  memset(addr, 0, 10);
+  addr[10] = addr[11] = 0xff;
+  return parseipv4(host, len, &addr[12]);
+}
+
+/* an address with an optional prefix length, IPv4 given in IPv6 form */
+static bool parseprefix(const char *s, size_t len, unsigned char *addr,
+                        unsigned int *bits)
+{
+  const char *slash = memchr(s, '/', len);
+  size_t alen = slash ? (size_t)(slash - s) : len;
+  bool v4 = !memchr(s, ':', alen);
+  unsigned int max = v4 ? 32 : 128;
+  if(v4) {
+    memset(addr, 0, 10);
+    addr[10] = addr[11] = 0xff;
+    if(!parseipv4(s, alen, &addr[12]))
+      return false;
+  }
+  else if(!parseipv6(s, alen, addr))
+    return false;
+  *bits = max;
+  if(slash) {
+    size_t i;
+    unsigned int num = 0;
+    if(alen + 1 == len)
+      return false;
+    for(i = alen + 1; i < len; i++) {
+      if(!ISDIGIT(s[i]) || (num > max))
+        return false;
+      num = num * 10 + (unsigned int)(s[i] - '0');
+    }
+    if(num > max)
+      return false;
+    *bits = num;
+  }
+  if(v4)
+    *bits += 96;
+  /* clear the bits after the prefix */
+  for(max = *bits; max < 128; max++)
+    addr[max / 8] &= (unsigned char)~(0x80 >> (max % 8));
+  return true;
+}
+
+static unsigned int ipbit(const unsigned char *a, unsigned int i)
+{
+  return (a[i / 8] >> (7 - i % 8)) & 1;
+}
+
+/* the number of leading bits that are the same, at most 'max' */
+static unsigned int ipcommon(const unsigned char *a, const unsigned char *b,
+                             unsigned int max)
+{
+  unsigned int i;
+  for(i = 0; i < max; i += 8) {
+    unsigned char x = a[i / 8] ^ b[i / 8];
+    if(x) {
+      while(!(x & 0x80)) {
+        x = (unsigned char)(x << 1);
+        i++;
+      }
+      return (i < max) ? i : max;
+    }
+  }
+  return max;
+}
+
+static uint32_t ipnew(struct option *o, struct iptree *t,
+                      const unsigned char *key, unsigned int bits)
+{
+  struct ipnode *n;
+  if(t->nnodes == t->size) {
+    size_t size = t->size ? t->size * 2 : 64;
+    n = realloc(t->node, size * sizeof(struct ipnode));
+    if(!n)
+      errorf(o, ERROR_MEM, "out of memory");
+    t->node = n;
+    t->size = size;
+  }
+  n = &t->node[t->nnodes];
+  memset(n, 0, sizeof(struct ipnode));
+  memcpy(n->key, key, 16);
+  n->bits = bits;
+  return (uint32_t)t->nnodes++;
+}
+
+/* the node for this prefix, made if needed */
+static struct ipnode *ipinsert(struct option *o, struct iptree *t,
+                               const unsigned char *key, unsigned int bits)
+{
+  uint32_t i = 0; /* the root covers all addresses */
+  for(;;) {
+    unsigned int b;
+    uint32_t c;
+    unsigned int common;
+    uint32_t n;
+    if(t->node[i].bits == bits)
+      return &t->node[i];
+    b = ipbit(key, t->node[i].bits);
+    c = t->node[i].child[b];
+    if(!c) {
+      n = ipnew(o, t, key, bits);
+      t->node[i].child[b] = n;
+      return &t->node[n];
+    }
+    common = ipcommon(t->node[c].key, key,
+                      (t->node[c].bits < bits) ? t->node[c].bits : bits);
+    if(common == t->node[c].bits) {
+      i = c;
+      continue;
+    }
+    /* they part ways before the child ends, put a node there */
+    n = ipnew(o, t, key, common);
+    t->node[n].child[ipbit(t->node[c].key, common)] = c;
+    t->node[i].child[b] = n;
+    i = n;
+  }
+}
+
+static void ipname(struct option *o, struct iptree *t, struct ipnode *n,
+                   const char *name, size_t len)
+{
+  if(t->nameslen + len + 1 > t->namessize) {
+    size_t size = t->namessize ? t->namessize * 2 : 256;
+    char *p;
+    while(size < t->nameslen + len + 1)
+      size *= 2;
+    p = realloc(t->names, size);
+    if(!p)
+      errorf(o, ERROR_MEM, "out of memory");
+    t->names = p;
+    t->namessize = size;
+  }
+  memcpy(&t->names[t->nameslen], name, len);
+  t->names[t->nameslen + len] = 0;
+  n->name = (uint32_t)t->nameslen + 1;
+  t->nameslen += len + 1;
+}
+
+static struct iptree *iptree(struct option *o)
+{
+  struct iptree *t = o->iptree;
+  unsigned char zero[16];
+  int i;
+  if(t)
+    return t;
+  t = o->iptree = calloc(1, sizeof(struct iptree));
+  if(!t)
+    errorf(o, ERROR_MEM, "out of memory");
+  memset(zero, 0, sizeof(zero));
+  ipnew(o, t, zero, 0);
+  for(i = 0; ipclasses[i]; i += 2) {
+    unsigned char key[16];
+    unsigned int bits;
+    parseprefix(ipclasses[i], strlen(ipclasses[i]), key, &bits);
+    ipname(o, t, ipinsert(o, t, key, bits), ipclasses[i + 1],
+           strlen(ipclasses[i + 1]));
+  }
+  return t;
+}
+
+/* the nodes with the longest prefix with a class and with an action */
+static void iplookup(struct iptree *t, const unsigned char *addr,
+                     struct ipnode **name, struct ipnode **action)
+{
+  uint32_t i = 0;
+  *name = *action = NULL;
+  for(;;) {
+    struct ipnode *n = &t->node[i];
+    if(ipcommon(n->key, addr, n->bits) != n->bits)
+      break;
+    if(n->name)
+      *name = n;
+    if(n->action)
+      *action = n;
+    if(n->bits == 128)
+      break;
+    i = n->child[ipbit(addr, n->bits)];
+    if(!i)
+      break;
+  }
+}
+
+/* --where-ip, read the prefixes from the file */
+static void whereipload(struct option *o)
+{
+  struct iptree *t = iptree(o);
+  char line[IP_LINE];
+  unsigned long lineno = 0;
+  FILE *f = fopen(o->whereip, "r");
+  if(!f)
+    errorf(o, ERROR_FILE, "--where-ip %s not found", o->whereip);
+  while(fgets(line, sizeof(line), f)) {
+    const char *p = line;
+    unsigned char action = IP_KEEP;
+    unsigned char key[16];
+    unsigned int bits;
+    size_t len;
+    struct ipnode *n;
+    lineno++;
+    while((*p == ' ') || (*p == '\t'))
+      p++;
+    if(*p == '!') {
+      action = IP_DROP;
+      p++;
+    }
+    len = strcspn(p, " \t\r\n#");
+    if(!len && (action == IP_KEEP))
+      continue;
+    if(!parseprefix(p, len, key, &bits)) {
+      trurl_warnf(o, "--where-ip %s:%lu: skipping bad prefix", o->whereip,
+                  lineno);
+      continue;
+    }
+    n = ipinsert(o, t, key, bits);
+    n->action = action;
+    /* an optional class name after it */
+    p += len;
+    while((*p == ' ') || (*p == '\t'))
+      p++;
+    len = strcspn(p, " \t\r\n#");
+    if(len)
+      ipname(o, t, n, p, len);
+  }
+  fclose(f);
+}
+
+/* --where-ip, true unless the host is an address it drops */
+static bool ipallowed(struct option *o, const char *host, size_t len)
+{
+  unsigned char addr[16];
+  struct ipnode *name;
+  struct ipnode *action;
+  if(!hostaddr(host, len, addr))
+    return true; /* not an address */
+  iplookup(o->iptree, addr, &name, &action);
+  return action && (action->action == IP_KEEP);
+}
+
+/* {ipclass} */
+static void showipclass(struct option *o, CURLU *uh)
+{
+  char *host;
+  unsigned char addr[16];
+  if(curl_url_get(uh, CURLUPART_HOST, &host, 0))
+    return;
+  if(hostaddr(host, strlen(host), addr)) {
+    struct iptree *t = iptree(o);
+    struct ipnode *name;
+    struct ipnode *action;
+    iplookup(t, addr, &name, &action);
+    outs(o, &t->names[name->name - 1]);
+  }
+  curl_free(host);
+}
+
+/*
+ * --psl, the Public Suffix List. The rules go into a host list trie from
+ * the top-level domain down, with "*" labels as they are, and the longest
+ * rule that matches a host is found with a lookup or two per label. Without
+ * a list, the only rule is "*" and the suffix is the top-level domain.
+ */
+#define MAX_LABELS 128 /* a host name has at most this many */
+
+#ifdef SUPPORTS_PUNYCODE
+/* add the punycode version of a rule with IDN labels */
+static void pslpuny(struct option *o, struct hostlist *l, const char *rule,
+                    size_t len, unsigned char flags)
+{
+  /* "*." is not a host name, it goes back in front afterwards */
+  bool wild = (len > 2) && (rule[0] == '*') && (rule[1] == '.');
+  size_t skip = wild ? 2 : 0;
+  char *url = curl_maprintf("http://%.*s/", (int)(len - skip), &rule[skip]);
+  CURLU *u = curl_url();
+  char *host = NULL;
+  if(!url || !u)
+    errorf(o, ERROR_MEM, "out of memory");
+  if(!curl_url_set(u, CURLUPART_URL, url, 0) &&
+     !curl_url_get(u, CURLUPART_HOST, &host, CURLU_PUNYCODE)) {
+    char *puny = curl_maprintf("%s%s", wild ? "*." : "", host);
+    if(!puny)
+      errorf(o, ERROR_MEM, "out of memory");
+    hostadd(o, l, puny, strlen(puny), flags);
+    curl_free(puny);
+  }
+  /* some libcurl versions return the host also when the conversion fails */
+  curl_free(host);
+  curl_url_cleanup(u);
+  curl_free(url);
+}
+#endif
+
+static void pslload(struct option *o)
+{
+  char line[MAX_HOST_LINE];
+  unsigned long lineno = 0;
+  struct hostlist *l;
+  FILE *f;
+  if(sharedpsl && !strcmp(sharedpsl->file, o->pslfile)) {
+    o->psl = sharedpsl;
+    return;
+  }
+  f = fopen(o->pslfile, "r");
+  if(!f)
+    errorf(o, ERROR_FILE, "--psl %s not found", o->pslfile);
+  l = o->psl = calloc(1, sizeof(struct hostlist));
+  if(!l) {
+    fclose(f);
+    errorf(o, ERROR_MEM, "out of memory");
+  }
+  l->flag = "--psl";
+  l->file = o->pslfile;
+  l->nodes = 1; /* the root */
+  hostsgrow(o, l);
+  while(fgets(line, sizeof(line), f)) {
+    char *rule = line;
+    unsigned char flags = PSL_RULE;
+    bool idn = false;
+    size_t len;
+    size_t i;
+    size_t label = 0;
+    lineno++;
+    if(!strchr(line, '\n') && !feof(f)) {
+      /* too long, skip the rest */
+      int ch;
+      do {
+        ch = getc(f);
+      } while((ch != EOF) && (ch != '\n'));
+      trurl_warnf(o, "--psl %s:%lu: skipping long line", l->file, lineno);
+      continue;
+    }
+    while((*rule == ' ') || (*rule == '\t'))
+      rule++;
+    if((rule[0] == '/') && (rule[1] == '/'))
+      continue; /* comment */
+    len = strcspn(rule, " \t\r\n");
+    if(len && (rule[0] == '!')) {
+      flags = PSL_EXCEPTION;
+      rule++;
+      len--;
+    }
+    if(!len)
+      continue;
+    for(i = 0; i < len; i++) {
+      if(rule[i] == '.') {
+        if(!label)
+          break;
+        label = 0;
+      }
+      else {
+        if(ISUPPER(rule[i]))
+          rule[i] |= ('a' - 'A');
+        else if(rule[i] & 0x80)
+          idn = true;
+        label++;
+      }
+      if(label > MAX_LABEL)
+        break;
+    }
+    if((i < len) || !label) {
+      trurl_warnf(o, "--psl %s:%lu: skipping bad rule", l->file, lineno);
+      continue;
+    }
+    hostadd(o, l, rule, len, flags);
+#ifdef SUPPORTS_PUNYCODE
+    if(idn)
+      pslpuny(o, l, rule, len, flags);
+#else
+    (void)idn;
+#endif
+  }
+  if(ferror(f))
+    errorf(o, ERROR_FILE, "--psl %s: %s", l->file, strerror(errno));
+  fclose(f);
+  if(!o->library)
+    sharedpsl = l;
+}
+
+/* the start of the public suffix, or of the registrable domain, in 'host'.
+   '*len' is set to where the part ends, without a trailing dot */
+static bool pslpart(struct option *o, const char *host, size_t *len,
+                    bool registrable, size_t *start)
+{
+  const struct hostlist *l = o->psl;
+  size_t label[MAX_LABELS]; /* the start of each label, from the right */
+  size_t nlabels = 0;
+  size_t best = 1; /* labels in the suffix */
+  size_t end = *len;
+  uint32_t parent = 0;
+  unsigned char addr[16];
+  size_t i;
+  if(hostaddr(host, end, addr))
+    return false; /* an address has no suffix */
+  if(end && (host[end - 1] == '.'))
+    end--;
+  *len = end;
+  i = end;
+  while(i) {
+    size_t s = i;
+    while(s && (host[s - 1] != '.'))
+      s--;
+    if((s == i) || (nlabels == MAX_LABELS))
+      return false;
+    label[nlabels++] = s;
+    i = s ? s - 1 : 0;
+  }
+  for(i = 0; l && (i < nlabels); i++) {
+    char lower[MAX_LABEL];
+    size_t llen = (i ? label[i - 1] - 1 : end) - label[i];
+    size_t j;
+    size_t n;
+    if(llen > MAX_LABEL)
+      break;
+    n = hostslot(l, parent, "*", 1);
+    if(l->slot[n].node && (l->slot[n].end & PSL_RULE))
+      best = i + 1;
+    for(j = 0; j < llen; j++) {
+      char c = host[label[i] + j];
+      lower[j] = ISUPPER(c) ? (char)(c | ('a' - 'A')) : c;
+    }
+    n = hostslot(l, parent, lower, llen);
+    if(!l->slot[n].node)
+      break;
+    if(l->slot[n].end & PSL_EXCEPTION) {
+      /* the rule without its leftmost label */
+      best = i ? i : 1;
+      break;
+    }
+    if(l->slot[n].end & PSL_RULE)
+      best = i + 1;
+    parent = l->slot[n].node;
+  }
+  if(!registrable) {
+    *start = label[best - 1];
+    return true;
+  }
+  if(best == nlabels)
+    return false; /* the host is a public suffix */
+  *start = label[best];
+  return true;
+}
+
+static void showqkey(struct option *o, const char *key, size_t klen,
+                     bool urldecode, bool showall)
+{
+  size_t i;
+  bool shown = false;
+  struct string *qp = urldecode ? o->qpairsdec : o->qpairs;
+
+  for(i = 0; i < o->nqpairs; i++) {
+    if(!strncmp(key, qp[i].str, klen) && (qp[i].str[klen] == '=')) {
+      if(shown)
+        outc(o, ' ');
+      outn(o, &qp[i].str[klen + 1], qp[i].len - klen - 1);
+      if(!showall)
+        break;
+      shown = true;
+    }
+  }
+}
+
+/* component to variable pointer */
+static const struct var *comp2var(const char *name, size_t vlen)
+{
+  int i;
+  for(i = 0; variables[i].name; i++)
+    if((strlen(variables[i].name) == vlen) &&
+       !strncmp(name, variables[i].name, vlen))
+      return &variables[i];
+  return NULL;
+}
+
+/*
+ * The host conversions of --punycode, --as-idn, puny: and idn: are kept for
+ * the IDN_ENTRIES hosts used last, as hosts repeat a lot and the conversion
+ * takes much longer than a lookup. A full URL gets the converted host put
+ * in place of the one in the URL libcurl returns without converting.
+ */
+
+static void idnunlink(struct idncache *c, struct idnentry *e)
+{
+  if(e->newer)
+    c->entry[e->newer - 1].older = e->older;
+  else
+    c->newest = e->older;
+  if(e->older)
+    c->entry[e->older - 1].newer = e->newer;
+  else
+    c->oldest = e->newer;
+  e->newer = e->older = 0;
+}
+
+/* make entry 'n', index + 1, the newest */
+static void idnfirst(struct idncache *c, uint32_t n)
+{
+  struct idnentry *e = &c->entry[n - 1];
+  e->older = c->newest;
+  e->newer = 0;
+  if(c->newest)
+    c->entry[c->newest - 1].newer = n;
+  else
+    c->oldest = n;
+  c->newest = n;
+}
+
+/* free the oldest entry for reuse, returns its index + 1 */
+static uint32_t idnevict(struct idncache *c)
+{
+  uint32_t n = c->oldest;
+  struct idnentry *e = &c->entry[n - 1];
+  uint32_t *p = &c->bucket[e->hash & (IDN_ENTRIES - 1)];
+  while(*p != n)
+    p = &c->entry[*p - 1].chain;
+  *p = e->chain;
+  idnunlink(c, e);
+  curl_free(e->host);
+  curl_free(e->conv);
+  return n;
+}
+
+/* the conversion of 'host', which this takes over */
+static struct idnentry *idnlookup(struct option *o, CURLU *uh, char *host,
+                                  unsigned int flags, unsigned int convert)
+{
+  struct idncache *c = o->idn;
+  uint64_t h = hash64(host, strlen(host)) ^ convert;
+  uint32_t *b;
+  uint32_t n;
+  struct idnentry *e;
+  if(!c) {
+    c = o->idn = calloc(1, sizeof(struct idncache));
+    if(!c) {
+      curl_free(host);
+      errorf(o, ERROR_MEM, "out of memory");
+    }
+  }
+  b = &c->bucket[h & (IDN_ENTRIES - 1)];
+  for(n = *b; n; n = e->chain) {
+    e = &c->entry[n - 1];
+    if((e->hash == h) && (e->convert == convert) && !strcmp(e->host, host)) {
+      c->hits++;
+      curl_free(host);
+      if(c->newest != n) {
+        idnunlink(c, e);
+        idnfirst(c, n);
+      }
+      return e;
+    }
+  }
+  c->misses++;
+  n = (c->nentries < IDN_ENTRIES) ? ++c->nentries : idnevict(c);
+  e = &c->entry[n - 1];
+  e->hash = h;
+  e->host = host;
+  e->convert = convert;
+  e->conv = NULL;
+  e->rc = curl_url_get(uh, CURLUPART_HOST, &e->conv, flags);
+  if(e->rc) {
+    /* some libcurl versions return the host also when it fails */
+    curl_free(e->conv);
+    e->conv = NULL;
+  }
+  e->chain = *b;
+  *b = n;
+  idnfirst(c, n);
+  return e;
+}
+
+/* true if the host has something to convert */
+static bool idnhost(const char *host)
+{
+  const char *p;
+  for(p = host; *p; p++) {
+    if(*p & 0x80)
+      return true;
+    if(((p == host) || (p[-1] == '.')) && ((p[0] | 0x20) == 'x') &&
+       ((p[1] | 0x20) == 'n') && (p[2] == '-') && (p[3] == '-'))
+      return true;
+  }
+  return false;
+}
+
+/* the host or the URL, converted with 'convert' in 'flags' */
+static CURLUcode idnget(struct option *o, CURLU *uh, CURLUPart part,
+                        unsigned int flags, unsigned int convert, char **out)
+{
+  unsigned int plain = flags & ~convert;
+  struct idnentry *e;
+  char *host = NULL;
+  char *url;
+  CURLUcode rc = curl_url_get(uh, CURLUPART_HOST, &host, plain);
+  if(rc || !idnhost(host)) {
+    curl_free(host);
+    return curl_url_get(uh, part, out, flags);
+  }
+  e = idnlookup(o, uh, host, flags, convert);
+  *out = NULL;
+  if(e->rc)
+    /* the URL fails the same way, no need to have libcurl try again */
+    return e->rc;
+  if(part == CURLUPART_HOST) {
+    *out = curl_maprintf("%s", e->conv);
+    return *out ? CURLUE_OK : CURLUE_OUT_OF_MEMORY;
+  }
+  if(!curl_url_get(uh, CURLUPART_URL, &url, plain)) {
+    size_t hlen = strlen(e->host);
+    char *start = strstr(url, "://");
+    if(start) {
+      char *end;
+      char *p;
+      start += 3;
+      end = start + strcspn(start, "/?#");
+      /* after the user info */
+      for(p = start; p < end; p++)
+        if(*p == '@')
+          start = p + 1;
+      if(((size_t)(end - start) >= hlen) && !strncmp(start, e->host, hlen))
+        *out = curl_maprintf("%.*s%s%s", (int)(start - url), url, e->conv,
+                             &start[hlen]);
+    }
+    curl_free(url);
+  }
+  if(*out)
+    return CURLUE_OK;
+  /* an unexpected URL */
+  return curl_url_get(uh, part, out, flags);
+}
+
+static CURLUcode geturlpart(struct option *o, int modifiers, CURLU *uh,
+                            CURLUPart part, char **out)
+{
+  unsigned int convert = 0;
+  unsigned int flags;
+  CURLUcode rc;
+#ifdef SUPPORTS_PUNYCODE
+  if((modifiers & VARMODIFIER_PUNY) || o->punycode)
+    convert |= CURLU_PUNYCODE;
+#endif
+#ifdef SUPPORTS_PUNY2IDN
+  if((modifiers & VARMODIFIER_PUNY2IDN) || o->puny2idn)
+    convert |= CURLU_PUNY2IDN;
+#endif
+  flags = convert |
+    (((modifiers & VARMODIFIER_DEFAULT) || o->default_port) ?
+     CURLU_DEFAULT_PORT :
+     ((part != CURLUPART_URL || o->keep_port) ?
+      0 : CURLU_NO_DEFAULT_PORT))|
+#ifdef SUPPORTS_GET_EMPTY
+    ((modifiers & VARMODIFIER_EMPTY) ? CURLU_GET_EMPTY : 0) |
+#endif
+    (o->curl ? 0 : CURLU_NON_SUPPORT_SCHEME) |
+    (((modifiers & VARMODIFIER_URLENCODED) || o->urlencode) ?
+     0 : CURLU_URLDECODE);
+  for(;;) {
+    if(convert && ((part == CURLUPART_HOST) || (part == CURLUPART_URL)))
+      rc = idnget(o, uh, part, flags, convert, out);
+    else
+      rc = curl_url_get(uh, part, out, flags);
+
+#ifdef SUPPORTS_PUNY2IDN
+    /* retry get w/ out puny2idn to handle invalid punycode conversions,
+       for this part only as the options are kept for the next URL */
+    if((rc == CURLUE_BAD_HOSTNAME) && (convert & CURLU_PUNY2IDN)) {
+      curl_free(*out);
+      *out = NULL;
+      convert &= ~CURLU_PUNY2IDN;
+      flags &= ~CURLU_PUNY2IDN;
+      trurl_warnf(o, "Error converting url to IDN [%s]",
+                  curl_url_strerror(rc));
+      continue;
+    }
+#endif
+    return rc;
+  }
+}
+
+static bool is_valid_trurl_error(CURLUcode rc)
+{
+  switch(rc) {
+  case CURLUE_OK:
+  case CURLUE_NO_SCHEME:
+  case CURLUE_NO_USER:
+  case CURLUE_NO_PASSWORD:
+  case CURLUE_NO_OPTIONS:
+  case CURLUE_NO_HOST:
+  case CURLUE_NO_PORT:
+  case CURLUE_NO_QUERY:
+  case CURLUE_NO_FRAGMENT:
+#ifdef SUPPORTS_ZONEID
+  case CURLUE_NO_ZONEID:
+#endif
+    /* silently ignore */
+    return false;
+  default:
+    return true;
+  }
+}
+
+static void showurl(struct option *o, int modifiers,
+                    CURLU *uh)
+{
+  char *url;
+  CURLUcode rc = geturlpart(o, modifiers, uh, CURLUPART_URL, &url);
+  if(rc) {
+    verify(o, ERROR_BADURL, "invalid url [%s]", curl_url_strerror(rc));
+    return;
+  }
+  outs(o, url);
+  curl_free(url);
+}
+
+/* {suffix} and {registrable} */
+static void showpsl(struct option *o, int mods, CURLU *uh, bool registrable)
+{
+  char *host;
+  size_t len;
+  size_t start;
+  if(geturlpart(o, mods, uh, CURLUPART_HOST, &host))
+    return;
+  len = strlen(host);
+  if(pslpart(o, host, &len, registrable, &start))
+    outn(o, &host[start], len - start);
+  curl_free(host);
+}
+
+static void get(struct option *o, CURLU *uh)
+{
+  const char *ptr = o->format;
+  bool done = false;
+  char startbyte = 0;
+  char endbyte = 0;
+
+  while(ptr && *ptr && !done) {
+    if(!startbyte && (('{' == *ptr) || ('[' == *ptr))) {
+      startbyte = *ptr;
+      if('{' == *ptr)
+        endbyte = '}';
+      else
+        endbyte = ']';
+    }
+    if(startbyte == *ptr) {
+      if(startbyte == ptr[1]) {
+        /* an escaped {-letter */
+        outc(o, startbyte);
+        ptr += 2;
+      }
+      else {
+        /* this is meant as a variable to output */
+        const char *start = ptr;
+        const char *end;
+        const char *cl;
+        size_t vlen;
+        size_t badlen = 0;
+        bool isquery = false;
+        bool queryall = false;
+        bool strict = false; /* strict mode, fail on URL decode problems */
+        bool must = false; /* must mode, fail on missing component */
+        int mods = 0;
+        end = strchr(ptr, endbyte);
+        ptr++; /* pass the { */
+        if(!end) {
+          /* syntax error */
+          outc(o, startbyte);
+          continue;
+        }
+
+        /* {path} {:path} {/path} */
+        if(*ptr == ':') {
+          mods |= VARMODIFIER_URLENCODED;
+          ptr++;
+        }
+        vlen = end - ptr;
+        do {
+          size_t wordlen;
+          cl = memchr(ptr, ':', vlen);
+          if(!cl)
+            break;
+          wordlen = cl - ptr + 1;
+
+          /* modifiers! */
+          if(!strncmp(ptr, "default:", wordlen))
+            mods |= VARMODIFIER_DEFAULT;
+          else if(!strncmp(ptr, "puny:", wordlen)) {
+            if(mods & VARMODIFIER_PUNY2IDN)
+              errorf(o, ERROR_GET,
+                     "puny modifier is mutually exclusive with idn");
+            mods |= VARMODIFIER_PUNY;
+          }
+          else if(!strncmp(ptr, "idn:", wordlen)) {
+            if(mods & VARMODIFIER_PUNY)
+              errorf(o, ERROR_GET,
+                     "idn modifier is mutually exclusive with puny");
+            mods |= VARMODIFIER_PUNY2IDN;
+          }
+          else if(!strncmp(ptr, "strict:", wordlen))
+            strict = true;
+          else if(!strncmp(ptr, "must:", wordlen)) {
+            must = true;
+            mods |= VARMODIFIER_EMPTY;
+          }
+          else if(!strncmp(ptr, "url:", wordlen))
+            mods |= VARMODIFIER_URLENCODED;
+          else {
+            if(!strncmp(ptr, "query-all:", wordlen)) {
+              isquery = true;
+              queryall = true;
+            }
+            else if(!strncmp(ptr, "query:", wordlen))
+              isquery = true;
+            else {
+              /* syntax error */
+              vlen = 0;
+              badlen = end - start + 1;
+            }
+            break;
+          }
+
+          ptr = cl + 1;
+          vlen = end - ptr;
+        } while(true);
+
+        if(isquery) {
+          showqkey(o, cl + 1, end - cl - 1,
+                   !o->urlencode && !(mods & VARMODIFIER_URLENCODED),
+                   queryall);
+        }
+        else if(!vlen)
+          errorf(o, ERROR_GET, "Bad --get syntax: %.*s", (int)badlen, start);
+        else if(!strncmp(ptr, "url", vlen))
+          showurl(o, mods, uh);
+        else if((vlen == 7) && !strncmp(ptr, "ipclass", 7))
+          showipclass(o, uh);
+        else if((vlen == 6) && !strncmp(ptr, "suffix", 6))
+          showpsl(o, mods, uh, false);
+        else if((vlen == 11) && !strncmp(ptr, "registrable", 11))
+          showpsl(o, mods, uh, true);
+        else {
+          const struct var *v = comp2var(ptr, vlen);
+          if(v) {
+            char *nurl;
+            /* ask for it URL encode always, to avoid libcurl warning on
+               content */
+            CURLUcode rc = geturlpart(o, mods | VARMODIFIER_URLENCODED,
+                                      uh, v->part, &nurl);
+            if(!rc && !(mods & VARMODIFIER_URLENCODED) && !o->urlencode) {
+              /* it should not be encoded in the output */
+              int olen;
+              char *dec = curl_easy_unescape(NULL, nurl, 0, &olen);
+              curl_free(nurl);
+              if(memchr(dec, '\0', (size_t)olen)) {
+                /* a binary zero cannot be shown */
+                rc = CURLUE_URLDECODE;
+                curl_free(dec);
+                dec = NULL;
+              }
+              nurl = dec;
+            }
+
+            if(rc == CURLUE_OK) {
+              outs(o, nurl);
+              curl_free(nurl);
+            }
+            else if(!is_valid_trurl_error(rc) && must)
+              errorf(o, ERROR_GET, "missing must:%s", v->name);
+            else if(is_valid_trurl_error(rc) || strict) {
+              if((rc == CURLUE_URLDECODE) && strict)
+                errorf(o, ERROR_GET, "problems URL decoding %s", v->name);
+              else
+                trurl_warnf(o, "%s (%s)", curl_url_strerror(rc), v->name);
+            }
+          }
+          else
+            errorf(o, ERROR_GET, "\"%.*s\" is not a recognized URL component",
+                   (int)vlen, ptr);
+        }
+        ptr = end + 1; /* pass the end */
+      }
+    }
+    else if('\\' == *ptr && ptr[1]) {
+      switch(ptr[1]) {
+      case 'r':
+        outc(o, '\r');
+        break;
+      case 'n':
+        outc(o, '\n');
+        break;
+      case 't':
+        outc(o, '\t');
+        break;
+      case '\\':
+        outc(o, '\\');
+        break;
+      case '{':
+        outc(o, '{');
+        break;
+      case '[':
+        outc(o, '[');
+        break;
+      default:
+        /* unknown, just output this */
+        outc(o, *ptr);
+        outc(o, ptr[1]);
+        break;
+      }
+      ptr += 2;
+    }
+    else {
+      outc(o, *ptr);
+      ptr++;
+    }
+  }
+  outc(o, '\n');
+}
+
+static void setcomponent(struct option *o, CURLU *uh, const struct var *v,
+                         const char *value, bool urlencode)
+{
+  CURLUcode rc;
+  if((v->part == CURLUPART_HOST) && ('[' == value[0]))
+    /* when setting an IPv6 numerical address, disable URL encoding */
+    urlencode = false;
+
+  rc = curl_url_set(uh, v->part, value[0] ? value : NULL,
+                    (o->curl ? 0 : CURLU_NON_SUPPORT_SCHEME) |
+                    (urlencode ? CURLU_URLENCODE : 0));
+  if(rc)
+    warnf(o, "Error setting %s: %s", v->name, curl_url_strerror(rc));
+}
+
+static const struct var *setone(CURLU *uh, const char *setline,
+                                struct option *o)
+{
+  const char *ptr = strchr(setline, '=');
+  const struct var *v = NULL;
+  if(ptr && (ptr > setline)) {
+    size_t vlen = ptr - setline;
+    bool urlencode = true;
+    bool conditional = false;
+    bool found = false;
+    if(vlen) {
+      int back = -1;
+      size_t reqlen = 1;
+      while(vlen > reqlen) {
+        if(ptr[back] == ':') {
+          urlencode = false;
+          vlen--;
+        }
+        else if(ptr[back] == '?') {
+          conditional = true;
+          vlen--;
+        }
+        else
+          break;
+        reqlen++;
+        back--;
+      }
+    }
+    v = comp2var(setline, vlen);
+    if(v) {
+      bool skip = false;
+      if(conditional) {
+        char *piece;
+        CURLUcode rc = curl_url_get(uh, v->part, &piece,
+                                    CURLU_NO_GUESS_SCHEME);
+        if(!rc) {
+          skip = true;
+          curl_free(piece);
+        }
+      }
+
+      if(!skip)
+        setcomponent(o, uh, v, &ptr[1], urlencode);
+      found = true;
+    }
+    if(!found)
+      errorf(o, ERROR_SET, "unknown component: %.*s", (int)vlen, setline);
+  }
+  else
+    errorf(o, ERROR_SET, "invalid --set syntax: %s", setline);
+  return v;
+}
+
+static unsigned int set(CURLU *uh, struct option *o)
+{
+  struct curl_slist *node;
+  unsigned int mask = 0;
+  for(node = o->set_list; node; node = node->next) {
+    const struct var *v;
+    char *setline = node->data;
+    v = setone(uh, setline, o);
+    if(v) {
+      if(mask & (1 << v->part))
+        errorf(o, ERROR_SET, "duplicate --set for component %s", v->name);
+      mask |= (1 << v->part);
+    }
+  }
+  return mask; /* the set components */
+}
+
+/* parse the --iterate options once, before the first URL */
+static void iterinit(struct option *o)
+{
+  unsigned int mask = 0;
+  size_t i;
+  for(i = 0; i < o->niters; i++) {
+    /* "part=item1 item2 item2" or "part=file" */
+    struct iterinfo *it = &o->iters[i];
+    const char *part = it->arg;
+    const char *sep = strchr(part, '=');
+    size_t plen;
+    if(!sep)
+      errorf(o, ERROR_ITER, "wrong iterate syntax");
+    plen = sep - part;
+    it->urlencode = true;
+    if(plen && (sep[-1] == ':')) {
+      it->urlencode = false;
+      plen--;
+    }
+    it->v = comp2var(part, plen);
+    if(!it->v)
+      errorf(o, ERROR_ITER, "bad component for iterate");
+    if(mask & (1 << it->v->part))
+      errorf(o, ERROR_ITER, "duplicate component for iterate: %s",
+             it->v->name);
+    mask |= (1 << it->v->part);
+    if(it->fromfile) {
+      it->name = sep + 1;
+      it->file = fopen(it->name, "rt");
+      if(!it->file)
+        errorf(o, ERROR_FILE, "--iterate-file %s not found", it->name);
+    }
+    else
+      it->list = sep + 1;
+  }
+}
+
+/* read the next non-empty line from an --iterate-file into the value
+   buffer, there is no length limit. Returns false at end of file. */
+static bool iterline(struct option *o, struct iterinfo *it)
+{
+  for(;;) {
+    size_t len = 0;
+    for(;;) {
+      if(it->size - len < 2) {
+        size_t size = it->size ? it->size * 2 : 256;
+        char *n = realloc(it->value, size);
+        if(!n)
+          errorf(o, ERROR_MEM, "out of memory");
+        o->allocs++;
+        it->value = n;
+        it->size = size;
+      }
+      if(!fgets(&it->value[len], (int)(it->size - len), it->file)) {
+        if(ferror(it->file))
+          errorf(o, ERROR_FILE, "fgets: %s", strerror(errno));
+        if(!len)
+          return false;
+        break; /* last line without newline */
+      }
+      len += strlen(&it->value[len]);
+      if(it->value[len - 1] == '\n')
+        break;
+    }
+    /* cut off the newline, CR and trailing spaces and tabs */
+    while(len && ((it->value[len - 1] == '\n') ||
+                  (it->value[len - 1] == '\r') ||
+                  (it->value[len - 1] == ' ') ||
+                  (it->value[len - 1] == '\t')))
+      len--;
+    it->value[len] = 0;
+    if(len)
+      return true;
+    /* skip empty lines */
+  }
+}
+
+/* copy the item at 'w' into the value buffer and move to the next one */
+static void iterstep(struct option *o, struct iterinfo *it, const char *w)
+{
+  const char *sepw = strchr(w, ' ');
+  size_t wlen;
+  if(sepw) {
+    wlen = sepw - w;
+    it->next = sepw + 1; /* next word is here */
+  }
+  else {
+    /* last word */
+    wlen = strlen(w);
+    it->next = NULL;
+  }
+  if(wlen >= it->size) {
+    char *n = realloc(it->value, wlen + 1);
+    if(!n)
+      errorf(o, ERROR_MEM, "out of memory");
+    o->allocs++;
+    it->value = n;
+    it->size = wlen + 1;
+  }
+  memcpy(it->value, w, wlen);
+  it->value[wlen] = 0;
+}
+
+static void iterfirst(struct option *o, struct iterinfo *it)
+{
+  if(it->file) {
+    if(fseek(it->file, 0, SEEK_SET))
+      errorf(o, ERROR_FILE, "--iterate-file %s: cannot rewind", it->name);
+    if(!iterline(o, it))
+      errorf(o, ERROR_ITER, "--iterate-file %s has no items", it->name);
+  }
+  else
+    iterstep(o, it, it->list);
+}
+
+/* returns false when there are no more items */
+static bool iternext(struct option *o, struct iterinfo *it)
+{
+  if(it->file)
+    return iterline(o, it);
+  if(!it->next)
+    return false;
+  iterstep(o, it, it->next);
+  return true;
+}
+
+UNITTEST void jsonString(struct option *o, const char *in, size_t len,
+                         bool lowercase)
+{
+  const unsigned char *i = (const unsigned char *)in;
+  const char *in_end = &in[len];
+  outc(o, '\"');
+  for(; i < (const unsigned char *)in_end; i++) {
+    switch(*i) {
+    case '\\':
+      outn(o, "\\\\", 2);
+      break;
+    case '\"':
+      outn(o, "\\\"", 2);
+      break;
+    case '\b':
+      outn(o, "\\b", 2);
+      break;
+    case '\f':
+      outn(o, "\\f", 2);
+      break;
+    case '\n':
+      outn(o, "\\n", 2);
+      break;
+    case '\r':
+      outn(o, "\\r", 2);
+      break;
+    case '\t':
+      outn(o, "\\t", 2);
+      break;
+    default:
+      if(*i < 32) {
+        char hex[7];
+        curl_msnprintf(hex, sizeof(hex), "\\u%04x", *i);
+        outn(o, hex, 6);
+      }
+      else {
+        char c = (char)*i;
+        if(lowercase && (c >= 'A' && c <= 'Z'))
+          /* do not use tolower() since that's locale specific */
+          c |= ('a' - 'A');
+        outc(o, c);
+      }
+      break;
+    }
+  }
+  outc(o, '\"');
+}
+
+static void json(struct option *o, CURLU *uh)
+{
+  int i;
+  bool first = true;
+  char *url;
+  CURLUcode rc = geturlpart(o, 0, uh, CURLUPART_URL, &url);
+  bool params_errors;
+  if(rc) {
+    verify(o, ERROR_BADURL, "invalid url [%s]", curl_url_strerror(rc));
+    return;
+  }
+  if(o->urls)
+    outc(o, ',');
+  outs(o, "\n  {\n    \"url\": ");
+  jsonString(o, url, strlen(url), false);
+  curl_free(url);
+  outs(o, ",\n    \"parts\": {\n");
+  /* special error handling required to not print params array. */
+  params_errors = false;
+  for(i = 0; variables[i].name; i++) {
+    char *part;
+    /* ask for the URL encoded version so that weird control characters do not
+       cause problems. URL decode it when push to json. */
+    rc = geturlpart(o, VARMODIFIER_URLENCODED, uh, variables[i].part, &part);
+    if(!rc) {
+      int olen = 0;
+      char *dec = NULL;
+
+      if(!o->urlencode) {
+        if(variables[i].part == CURLUPART_QUERY) {
+          /* query parts have '+' for space */
+          char *n;
+          char *p = part;
+          do {
+            n = strchr(p, '+');
+            if(n) {
+              *n = ' ';
+              p = n + 1;
+            }
+          } while(n);
+        }
+
+        dec = curl_easy_unescape(NULL, part, 0, &olen);
+        if(!dec)
+          errorf(o, ERROR_MEM, "out of memory");
+      }
+
+      if(!first)
+        outs(o, ",\n");
+      first = false;
+      outs(o, "      \"");
+      outs(o, variables[i].name);
+      outs(o, "\": ");
+      if(dec)
+        jsonString(o, dec, (size_t)olen, false);
+      else
+        jsonString(o, part, strlen(part), false);
+      curl_free(part);
+      curl_free(dec);
+    }
+    else if(is_valid_trurl_error(rc)) {
+      trurl_warnf(o, "%s (%s)", curl_url_strerror(rc), variables[i].name);
+      params_errors = true;
+    }
+  }
+  if(o->psl) {
+    char *host;
+    if(!geturlpart(o, 0, uh, CURLUPART_HOST, &host)) {
+      static const char *const pslparts[] = { "suffix", "registrable" };
+      for(i = 0; i < 2; i++) {
+        size_t len = strlen(host);
+        size_t start;
+        if(pslpart(o, host, &len, i == 1, &start)) {
+          if(!first)
+            outs(o, ",\n");
+          first = false;
+          outs(o, "      \"");
+          outs(o, pslparts[i]);
+          outs(o, "\": ");
+          jsonString(o, &host[start], len - start, false);
+        }
+      }
+      curl_free(host);
+    }
+  }
+  outs(o, "\n    }");
+  first = true;
+  if(o->nqpairs && !params_errors) {
+    size_t j;
+    outs(o, ",\n    \"params\": [\n");
+    for(j = 0; j < o->nqpairs; j++) {
+      const struct string *qd = &o->qpairsdec[j];
+      const char *sep = memchr(qd->str, '=', qd->len);
+      const char *value = sep ? sep + 1 : "";
+      int value_len = (int)qd->len - (int)(value - qd->str);
+      /* don't print out empty/trimmed values */
+      if(!qd->len || !qd->str[0])
+        continue;
+      if(!first)
+        outs(o, ",\n");
+      first = false;
+      outs(o, "      {\n        \"key\": ");
+      jsonString(o, qd->str, sep ? (size_t)(sep - qd->str) : qd->len, false);
+      outs(o, ",\n        \"value\": ");
+      jsonString(o, sep ? value : "", sep ? value_len : 0, false);
+      outs(o, "\n      }");
+    }
+    outs(o, "\n    ]");
+  }
+  outs(o, "\n  }");
+}
+
+/* --trim query="utm_*" */
+static bool trim(struct option *o)
+{
+  bool query_is_modified = false;
+  struct curl_slist *node;
+  for(node = o->trim_list; node; node = node->next) {
+    char *ptr = node->data;
+    if(ptr) {
+      /* 'ptr' should be a fixed string or a pattern ending with an
+         asterisk */
+      size_t inslen;
+      bool pattern = false;
+      size_t i;
+      char *temp = NULL;
+
+      inslen = strlen(ptr);
+      if(inslen) {
+        pattern = ptr[inslen - 1] == '*';
+        if(pattern && (inslen > 1)) {
+          pattern ^= ptr[inslen - 2] == '\\';
+          if(!pattern) {
+            /* the two final letters are \*, but the backslash needs to be
+               removed. Get a copy and edit that accordingly. */
+            temp = arenadup(o, ptr, inslen);
+            if(!temp)
+              errorf(o, ERROR_MEM, "out of memory");
+            temp[inslen - 2] = '*';
+            temp[inslen - 1] = '\0';
+            ptr = temp;
+            inslen--; /* one byte shorter now */
+          }
+        }
+        if(pattern)
+          inslen--;
+      }
+
+      for(i = 0; i < o->nqpairs; i++) {
+        const char *q = o->qpairs[i].str;
+        const char *sep = strchr(q, '=');
+        size_t qlen;
+        if(sep)
+          qlen = sep - q;
+        else
+          qlen = strlen(q);
+
+        if((pattern && (inslen <= qlen) && !casecompare(q, ptr, inslen)) ||
+           (!pattern && (inslen == qlen) && !casecompare(q, ptr, inslen))) {
+          /* this qpair should be stripped out */
+          o->qpairs[i].str = qdeleted; /* marked as deleted */
+          o->qpairs[i].len = 0;
+          o->qpairsdec[i].str = qdeleted; /* marked as deleted */
+          o->qpairsdec[i].len = 0;
+          query_is_modified = true;
+        }
+      }
+    }
+  }
+  return query_is_modified;
+}
+
+UNITTEST char *decodequery(struct option *o, char *str, size_t len,
+                           size_t *olen)
+{
+  /* handle '+' to ' ' outside of the URL decoding */
+  char *p = str;
+  size_t plen = len;
+  do {
+    char *n = memchr(p, '+', plen);
+    if(n) {
+      *n = ' ';
+      ++n;
+      plen -= (n - p);
+    }
+    p = n;
+  } while(p);
+  return arenadecode(o, str, len, olen);
+}
+
+UNITTEST char *encodequery(struct option *o, char *str, size_t len)
+{
+  /* to handle ' ' to '+' escaping we cannot use libcurl's URL encode
+     function */
+  char *dupe = arenaalloc(o, len * 3 + 1); /* worst case */
+  char *p = dupe;
+  if(!p)
+    return NULL;
+
+  while(len--) {
+    char in = *str++;
+
+    if(in == ' ')
+      *dupe++ = '+';
+    else if(ISUNRESERVED(in))
+      *dupe++ = in;
+    else {
+      /* encode it */
+      const char hex[] = "0123456789abcdef";
+      dupe[0] = '%';
+      dupe[1] = hex[(unsigned char)in >> 4];
+      dupe[2] = hex[(unsigned char)in & 0xf];
+      dupe += 3;
+    }
+  }
+  *dupe = 0;
+  return p;
+}
+
+/* URL decode, then URL encode it back to normalize. But don't touch
+   the first '=' if there is one */
+UNITTEST struct string *memdupzero(struct option *o, char *source,
+                                   size_t len, bool *modified)
+{
+  struct string *ret = arenaalloc(o, sizeof(struct string));
+  if(!ret)
+    return NULL;
+
+  ret->str = NULL;
+  ret->len = 0;
+  if(len) {
+    char *sep = memchr(source, '=', len);
+    char *encode;
+    size_t olen;
+    if(!sep) { /* no '=' */
+      char *decode = decodequery(o, source, len, &olen);
+      if(!decode)
+        return NULL;
+      encode = encodequery(o, decode, olen);
+      if(!encode)
+        return NULL;
+    }
+    else {
+      char *el = NULL;
+      char *er = NULL;
+      size_t ellen = 0;
+      size_t erlen = 0;
+
+      /* decode and encode both sides */
+      size_t leftside = sep - source;
+      size_t rightside = len - leftside - 1;
+      if(leftside) {
+        char *left = decodequery(o, source, leftside, &olen);
+        if(!left)
+          return NULL;
+        el = encodequery(o, left, olen);
+        if(!el)
+          return NULL;
+        ellen = strlen(el);
+      }
+      if(rightside) {
+        char *right = decodequery(o, sep + 1, rightside, &olen);
+        if(!right)
+          return NULL;
+        er = encodequery(o, right, olen);
+        if(!er)
+          return NULL;
+        erlen = strlen(er);
+      }
+
+      encode = arenaalloc(o, ellen + erlen + 2);
+      if(!encode)
+        return NULL;
+      if(ellen)
+        memcpy(encode, el, ellen);
+      encode[ellen] = '=';
+      if(erlen)
+        memcpy(&encode[ellen + 1], er, erlen);
+      encode[ellen + erlen + 1] = 0;
+    }
+    olen = strlen(encode);
+
+    if((olen != len) || strcmp(encode, source))
+      *modified |= true;
+    ret->str = encode;
+    ret->len = olen;
+  }
+  return ret;
+}
+
+/* URL decode the pair and return it in an allocated chunk */
+static struct string *memdupdec(struct option *o, char *source, size_t len,
+                                bool json)
+{
+  char *sep = memchr(source, '=', len);
+  char *left = NULL;
+  char *right = NULL;
+  size_t right_len = 0;
+  size_t left_len = 0;
+  char *str;
+  struct string *ret;
+  left = arenadecode(o, source, sep ? (size_t)(sep - source) : len, &left_len);
+  if(!left)
+    return NULL;
+  if(sep) {
+    char *p;
+    size_t plen;
+    right = arenadecode(o, sep + 1, len - (sep - source) - 1, &right_len);
+    if(!right)
+      return NULL;
+
+    /* convert null bytes to periods */
+    for(plen = right_len, p = right; plen; plen--, p++) {
+      if(!*p && !json) {
+        *p = REPLACE_NULL_BYTE;
+      }
+    }
+  }
+  str = arenaalloc(o, left_len + (sep ? (right_len + 1) : 0) + 1);
+  ret = arenaalloc(o, sizeof(struct string));
+  if(!str || !ret)
+    return NULL;
+  memcpy(str, left, left_len);
+  if(sep) {
+    str[left_len] = '=';
+    memcpy(str + 1 + left_len, right, right_len);
+  }
+  ret->str = str;
+  ret->len = left_len + (sep ? (right_len + 1) : 0);
+  str[ret->len] = 0;
+  return ret;
+}
+
+static void freeqpairs(struct option *o)
+{
+  o->nqpairs = 0;
+  arenareset(o);
+}
+
+/* store the pair both encoded and decoded, return if modified */
+static bool addqpair(struct option *o, char *pair, size_t len, bool json)
+{
+  bool modified = false;
+  if(o->nqpairs < MAX_QPAIRS) {
+    struct string *p = memdupzero(o, pair, len, &modified);
+    struct string *pdec = memdupdec(o, pair, len, json);
+    if(p && pdec) {
+      o->qpairs[o->nqpairs].str = p->str;
+      o->qpairs[o->nqpairs].len = p->len;
+      o->qpairsdec[o->nqpairs].str = pdec->str;
+      o->qpairsdec[o->nqpairs].len = pdec->len;
+      o->nqpairs++;
+    }
+  }
+  else
+    warnf(o, "too many query pairs");
+
+  return modified;
+}
+
+/* convert the query string into an array of name=data pair */
+static bool extractqpairs(CURLU *uh, struct option *o)
+{
+  char *q = NULL;
+  bool modified = false;
+  o->nqpairs = 0;
+  /* extract the query */
+  if(!curl_url_get(uh, CURLUPART_QUERY, &q, 0)) {
+    char *p = q;
+    while(*p) {
+      size_t len;
+      char *amp = strchr(p, o->qsep[0]);
+      if(!amp)
+        len = strlen(p);
+      else
+        len = amp - p;
+      modified |= addqpair(o, p, len, o->jsonout);
+      if(amp)
+        p = amp + 1;
+      else
+        break;
+    }
+  }
+  curl_free(q);
+  return modified;
+}
+
+static void qpair2query(CURLU *uh, struct option *o)
+{
+  size_t i;
+  size_t len = 0;
+  char *nq;
+  char *p;
+  for(i = 0; i < o->nqpairs; i++)
+    len += o->qpairs[i].len + 1;
+  p = nq = arenaalloc(o, len + 1);
+  if(!nq)
+    errorf(o, ERROR_MEM, "out of memory");
+  for(i = 0; i < o->nqpairs; i++) {
+    if(o->qpairs[i].len) {
+      if(p > nq)
+        *p++ = o->qsep[0];
+      memcpy(p, o->qpairs[i].str, o->qpairs[i].len);
+      p += o->qpairs[i].len;
+    }
+  }
+  *p = 0;
+  if(o->nqpairs) {
+    CURLUcode rc = curl_url_set(uh, CURLUPART_QUERY, nq, 0);
+    if(rc)
+      trurl_warnf(o, "internal problem: failed to store updated query in URL");
+  }
+}
+
+/* sort case insensitively */
+UNITTEST int cmpfunc(const void *p1, const void *p2)
+{
+  int i;
+  int len = (int)((((const struct string *)p1)->len) <
+                  (((const struct string *)p2)->len) ?
+                  (((const struct string *)p1)->len) :
+                  (((const struct string *)p2)->len));
+
+  for(i = 0; i < len; i++) {
+    char c1 = ((const struct string *)p1)->str[i] | ('a' - 'A');
+    char c2 = ((const struct string *)p2)->str[i] | ('a' - 'A');
+    if(c1 != c2)
+      return c1 - c2;
+  }
+
+  return 0;
+}
+
+static bool sortquery(struct option *o)
+{
+  if(o->sort_query) {
+    /* not these two lists may no longer be the same order after the sort */
+    qsort(&o->qpairs[0], o->nqpairs, sizeof(struct string), cmpfunc);
+    qsort(&o->qpairsdec[0], o->nqpairs, sizeof(struct string), cmpfunc);
+    return true;
+  }
+  return false;
+}
+
+static bool replace(struct option *o)
+{
+  bool query_is_modified = false;
+  struct curl_slist *node;
+  for(node = o->replace_list; node; node = node->next) {
+    struct string key;
+    struct string value;
+    bool replaced = false;
+    size_t i;
+    key.str = node->data;
+    value.str = strchr(key.str, '=');
+    if(value.str) {
+      key.len = value.str++ - key.str;
+      value.len = strlen(value.str);
+    }
+    else {
+      key.len = strlen(key.str);
+      value.str = NULL;
+      value.len = 0;
+    }
+    for(i = 0; i < o->nqpairs; i++) {
+      char *q = o->qpairs[i].str;
+      struct string *pdec, *p;
+
+      /* not the correct query, move on */
+      if(strncmp(q, key.str, key.len))
+        continue;
+      /* this is a duplicate remove it. */
+      if(replaced) {
+        o->qpairs[i].len = 0;
+        o->qpairs[i].str = qdeleted;
+        o->qpairsdec[i].len = 0;
+        o->qpairsdec[i].str = qdeleted;
+        continue;
+      }
+      pdec = memdupdec(o, key.str, key.len + value.len + 1, o->jsonout);
+      p = memdupzero(o, key.str, key.len + value.len + (value.str ? 1 : 0),
+                     &query_is_modified);
+      if(!p || !pdec)
+        errorf(o, ERROR_MEM, "out of memory");
+      o->qpairs[i].len = p->len;
+      o->qpairs[i].str = p->str;
+      o->qpairsdec[i].len = pdec->len;
+      o->qpairsdec[i].str = pdec->str;
+      query_is_modified = replaced = true;
+    }
+
+    if(!replaced && o->force_replace) {
+      addqpair(o, key.str, strlen(key.str), o->jsonout);
+      query_is_modified = true;
+    }
+  }
+  return query_is_modified;
+}
+
+static CURLUcode seturl(struct option *o, CURLU *uh, const char *url)
+{
+  return curl_url_set(uh, CURLUPART_URL, url,
+                      (o->no_guess_scheme ? 0 : CURLU_GUESS_SCHEME) |
+                      (o->curl ? 0 : CURLU_NON_SUPPORT_SCHEME) |
+                      (o->accept_space ? CURLU_ALLOW_SPACE : 0) |
+                      CURLU_URLENCODE);
+}
+
+UNITTEST char *canonical_path(const char *path)
+{
+  /* split the path per slash, URL decode + encode, then put together again */
+  size_t len = strlen(path);
+  const char *sl;
+  char *dupe = NULL;
+
+  do {
+    char *opath;
+    char *npath;
+    char *ndupe;
+    int olen;
+    size_t partlen;
+
+    sl = memchr(path, '/', len);
+    partlen = sl ? (size_t)(sl - path) : len;
+
+    if(partlen) {
+      /* First URL decode the part */
+      opath = curl_easy_unescape(NULL, path, (int)partlen, &olen);
+      if(!opath)
+        return NULL;
+
+      /* Then URL encode it again */
+      npath = curl_easy_escape(NULL, opath, olen);
+      curl_free(opath);
+      if(!npath)
+        return NULL;
+
+      ndupe = curl_maprintf("%s%s%s", dupe ? dupe : "", npath, sl ? "/" : "");
+      curl_free(npath);
+    }
+    else if(sl) {
+      /* zero length part but a slash */
+      ndupe = curl_maprintf("%s/", dupe ? dupe : "");
+    }
+    else {
+      /* no part, no slash */
+      break;
+    }
+    curl_free(dupe);
+    if(!ndupe)
+      return NULL;
+
+    dupe = ndupe;
+    if(sl) {
+      path = sl + 1;
+      len -= partlen + 1;
+    }
+
+  } while(sl);
+
+  return dupe;
+}
+
+static void normalize_part(struct option *o, CURLU *uh, CURLUPart part)
+{
+  char *ptr;
+  size_t ptrlen = 0;
+  (void)curl_url_get(uh, part, &ptr, 0);
+
+  if(ptr)
+    ptrlen = strlen(ptr);
+
+  if(ptrlen) {
+    int olen;
+    char *uptr;
+    /* First URL decode the component */
+    char *rawptr = curl_easy_unescape(NULL, ptr, (int)ptrlen, &olen);
+    if(!rawptr)
+      errorf(o, ERROR_MEM, "out of memory");
+
+    /* Then URL encode it again */
+    uptr = curl_easy_escape(NULL, rawptr, olen);
+    curl_free(rawptr);
+    if(!uptr)
+      errorf(o, ERROR_MEM, "out of memory");
+
+    if(strcmp(ptr, uptr))
+      /* changed, store the updated one */
+      (void)curl_url_set(uh, part, uptr, 0);
+    curl_free(uptr);
+  }
+  curl_free(ptr);
+}
+
+/*
+ * --unique keeps a 64 bit fingerprint of every output in an open addressing
+ * hash table with linear probing, 8 bytes per slot. A new fingerprint that
+ * collides with an old one for different output makes that output get
+ * dropped, with 64 bits that takes billions of URLs to become likely.
+ * --unique-exact also keeps the output itself to compare with.
+ */
+#define UNIQUE_SLOTS 4096 /* initial table size */
+
+/* double the table size */
+static void uniquegrow(struct option *o)
+{
+  struct uniqset *u = o->unique;
+  size_t nsize = u->size ? u->size * 2 : UNIQUE_SLOTS;
+  uint64_t *nhash = calloc(nsize, sizeof(uint64_t));
+  uint64_t *nwhere = NULL;
+  size_t i;
+  if(!nhash)
+    errorf(o, ERROR_MEM, "out of memory");
+  if(u->exact) {
+    nwhere = malloc(nsize * sizeof(uint64_t));
+    if(!nwhere) {
+      free(nhash);
+      errorf(o, ERROR_MEM, "out of memory");
+    }
+  }
+  for(i = 0; i < u->size; i++) {
+    if(u->hash[i]) {
+      size_t n = (size_t)u->hash[i] & (nsize - 1);
+      while(nhash[n])
+        n = (n + 1) & (nsize - 1);
+      nhash[n] = u->hash[i];
+      if(nwhere)
+        nwhere[n] = u->where[i];
+    }
+  }
+  free(u->hash);
+  free(u->where);
+  u->hash = nhash;
+  u->where = nwhere;
+  u->size = nsize;
+}
+
+/* --unique-exact, keep the output and return where it is */
+static uint64_t uniquekeep(struct option *o, const char *data, size_t len)
+{
+  struct uniqset *u = o->unique;
+  size_t need = u->datalen + sizeof(size_t) + len;
+  uint64_t where = u->datalen;
+  if(need > u->datasize) {
+    size_t nsize = u->datasize ? u->datasize : OUTBUF_SIZE;
+    char *n;
+    while(nsize < need)
+      nsize *= 2;
+    n = realloc(u->data, nsize);
+    if(!n)
+      errorf(o, ERROR_MEM, "out of memory");
+    u->data = n;
+    u->datasize = nsize;
+  }
+  memcpy(&u->data[u->datalen], &len, sizeof(size_t));
+  memcpy(&u->data[u->datalen + sizeof(size_t)], data, len);
+  u->datalen = need;
+  return where;
+}
+
+/*
+ * --unique-approx picks a block with the high bits of the fingerprint and
+ * sets k bits in it, by double hashing with the low bits. All bits for one
+ * output are in the same cache line.
+ */
+static bool bloomed(struct uniqset *u, uint64_t h)
+{
+  unsigned char *block =
+    &u->bloom[(size_t)(((h >> 32) * u->blocks) >> 32) * BLOOM_BLOCK];
+  unsigned int a = (unsigned int)h & (BLOOM_BLOCK * 8 - 1);
+  unsigned int b = (unsigned int)(h >> 9) | 1;
+  unsigned int i;
+  bool seen = true;
+  for(i = 0; i < u->k; i++) {
+    unsigned int bit = (a + i * b) & (BLOOM_BLOCK * 8 - 1);
+    unsigned char mask = (unsigned char)(1 << (bit & 7));
+    if(!(block[bit >> 3] & mask)) {
+      block[bit >> 3] |= mask;
+      seen = false;
+    }
+  }
+  if(!seen)
+    u->count++;
+  return seen;
+}
+
+/* returns true if this output was seen before, remembers it if not */
+static bool repeated(struct option *o, const char *data, size_t len)
+{
+  struct uniqset *u = o->unique;
+  uint64_t h = hash64(data, len);
+  size_t n;
+  if(u->bloom)
+    return bloomed(u, h);
+  if(u->count * 10 >= u->size * 7)
+    uniquegrow(o);
+  n = (size_t)h & (u->size - 1);
+  while(u->hash[n]) {
+    if(u->hash[n] == h) {
+      const char *old;
+      size_t oldlen;
+      if(!u->exact)
+        return true;
+      old = &u->data[u->where[n]];
+      memcpy(&oldlen, old, sizeof(size_t));
+      if((oldlen == len) && !memcmp(&old[sizeof(size_t)], data, len))
+        return true;
+      u->collisions++;
+    }
+    n = (n + 1) & (u->size - 1);
+  }
+  u->hash[n] = h;
+  if(u->exact)
+    u->where[n] = uniquekeep(o, data, len);
+  u->count++;
+  return false;
+}
+
+/* drop the output since 'mark' if it was output before */
+static bool unique(struct option *o, size_t mark)
+{
+  if((o->out.len > mark) &&
+     repeated(o, &o->out.buf[mark], o->out.len - mark)) {
+    o->out.len = mark;
+    o->unique->dropped++;
+    return false;
+  }
+  return true;
+}
+
+/* at exit, say what --unique did and what it took */
+void trurl_unique_show(struct option *o)
+{
+  struct uniqset *u = o->unique;
+  size_t bytes = u->size * sizeof(uint64_t) * (u->exact ? 2 : 1) +
+    u->datasize + (size_t)u->blocks * BLOOM_BLOCK;
+  if(u->bloom) {
+    /* a Bloom filter with k bits per output stays at the rate asked for up
+       to this many, more or less */
+    double capacity = (double)u->blocks * BLOOM_BLOCK * 8 * 0.693 / u->k;
+    trurl_warnf(o, "--unique-approx: %" CURL_FORMAT_CURL_OFF_TU
+                " unique, %" CURL_FORMAT_CURL_OFF_TU " repeats dropped, "
+                "%.1f MB used, room for %.0f at rate %g", (curl_off_t)u->count,
+                (curl_off_t)u->dropped, (double)bytes / 1e6, capacity,
+                u->fprate);
+    return;
+  }
+  trurl_warnf(o, "--unique: %" CURL_FORMAT_CURL_OFF_TU " unique, %"
+              CURL_FORMAT_CURL_OFF_TU " repeats dropped, %.1f MB used",
+              (curl_off_t)u->count, (curl_off_t)u->dropped,
+              (double)bytes / 1e6);
+  if(u->collisions)
+    trurl_warnf(o, "--unique: %" CURL_FORMAT_CURL_OFF_TU
+                " fingerprint collisions", (curl_off_t)u->collisions);
+}
+
+/*
+ * --unique-state keeps the --unique-approx filter between runs. The file
+ * has an 8 byte magic, then k as 4 bytes, the number of blocks and the
+ * number of unique outputs as 8 bytes each, all little endian, and then the
+ * blocks.
+ */
+#define BLOOM_MAGIC "trurlbf1"
+#define BLOOM_HEADER 28
+
+static void le(unsigned char *p, uint64_t v, int len)
+{
+  int i;
+  for(i = 0; i < len; i++)
+    p[i] = (unsigned char)(v >> (i * 8));
+}
+
+static uint64_t unle(const unsigned char *p, int len)
+{
+  uint64_t v = 0;
+  while(len--)
+    v = (v << 8) | p[len];
+  return v;
+}
+
+void trurl_unique_load(struct option *o)
+{
+  struct uniqset *u = o->unique;
+  unsigned char head[BLOOM_HEADER];
+  FILE *f;
+  if(!u->state)
+    return;
+  if(!u->bloom)
+    errorf(o, ERROR_FLAG, "--unique-state needs --unique-approx");
+  f = fopen(u->state, "rb");
+  if(!f) {
+    if(errno == ENOENT)
+      return; /* the first run */
+    errorf(o, ERROR_FILE, "--unique-state %s: %s", u->state, strerror(errno));
+  }
+  if((fread(head, 1, BLOOM_HEADER, f) != BLOOM_HEADER) ||
+     memcmp(head, BLOOM_MAGIC, 8)) {
+    fclose(f);
+    errorf(o, ERROR_FILE, "--unique-state %s: not a trurl filter", u->state);
+  }
+  if((unle(&head[8], 4) != u->k) || (unle(&head[12], 8) != u->blocks)) {
+    fclose(f);
+    errorf(o, ERROR_FILE, "--unique-state %s: made with another "
+           "--unique-approx", u->state);
+  }
+  u->count = (size_t)unle(&head[20], 8);
+  if(fread(u->bloom, BLOOM_BLOCK, (size_t)u->blocks, f) != u->blocks) {
+    fclose(f);
+    errorf(o, ERROR_FILE, "--unique-state %s: truncated", u->state);
+  }
+  fclose(f);
+}
+
+/* written to a new file that replaces the old one when complete */
+void trurl_unique_save(struct option *o)
+{
+  struct uniqset *u = o->unique;
+  unsigned char head[BLOOM_HEADER];
+  char *tmp;
+  FILE *f;
+  bool fail;
+  if(!u->state)
+    return;
+  tmp = curl_maprintf("%s.tmp", u->state);
+  if(!tmp)
+    errorf(o, ERROR_MEM, "out of memory");
+  memcpy(head, BLOOM_MAGIC, 8);
+  le(&head[8], u->k, 4);
+  le(&head[12], u->blocks, 8);
+  le(&head[20], u->count, 8);
+  f = fopen(tmp, "wb");
+  if(!f) {
+    trurl_warnf(o, "--unique-state %s: %s", tmp, strerror(errno));
+    curl_free(tmp);
+    return;
+  }
+  fail = (fwrite(head, 1, BLOOM_HEADER, f) != BLOOM_HEADER) ||
+    (fwrite(u->bloom, BLOOM_BLOCK, (size_t)u->blocks, f) != u->blocks);
+  fail |= !!fclose(f);
+  if(fail || rename(tmp, u->state)) {
+    trurl_warnf(o, "--unique-state %s: %s", u->state, strerror(errno));
+    remove(tmp);
+  }
+  curl_free(tmp);
+}
+
+/*
+ * --count-by makes the key with a --get format and counts it in a hash
+ * table with linear probing, that points into an array of the keys. With
+ * --top, the Space-Saving algorithm keeps only that many keys: a new key
+ * replaces the one with the lowest count and takes over its count, so a
+ * count can be too high by at most the count it took over. The keys are
+ * then kept in a min-heap on count.
+ */
+#define COUNT_SLOTS 1024 /* initial table size */
+
+static void countinit(struct option *o)
+{
+  struct counter *c = calloc(1, sizeof(struct counter));
+  if(!c)
+    errorf(o, ERROR_MEM, "out of memory");
+  o->counter = c;
+  /* a component name or a --get format */
+  c->format = strchr(o->countby, '{') ?
+    curl_maprintf("%s", o->countby) : curl_maprintf("{%s}", o->countby);
+  if(!c->format)
+    errorf(o, ERROR_MEM, "out of memory");
+  o->format = c->format;
+  c->top = o->top;
+  if(c->top) {
+    /* the table stays at most half full */
+    c->nslots = COUNT_SLOTS;
+    while(c->nslots < c->top * 2)
+      c->nslots *= 2;
+    c->maxentries = c->top;
+    c->slot = calloc(c->nslots, sizeof(size_t));
+    c->entry = calloc(c->maxentries, sizeof(struct countkey));
+    if(!c->slot || !c->entry)
+      errorf(o, ERROR_MEM, "out of memory");
+  }
+}
+
+static const char *countkeystr(struct counter *c, struct countkey *e)
+{
+  return c->top ? e->topkey : &c->keys[e->key];
+}
+
+/* the slot with this key, or the free slot where it goes */
+static size_t countfind(struct counter *c, uint64_t h, const char *key,
+                        size_t len)
+{
+  size_t mask = c->nslots - 1;
+  size_t n = (size_t)h & mask;
+  while(c->slot[n]) {
+    struct countkey *e = &c->entry[c->slot[n] - 1];
+    if((e->hash == h) && (e->len == len) &&
+       !memcmp(countkeystr(c, e), key, len))
+      break;
+    n = (n + 1) & mask;
+  }
+  return n;
+}
+
+static void countgrow(struct option *o)
+{
+  struct counter *c = o->counter;
+  size_t nslots = c->nslots ? c->nslots * 2 : COUNT_SLOTS;
+  size_t *slot = calloc(nslots, sizeof(size_t));
+  struct countkey *entry;
+  size_t i;
+  if(!slot)
+    errorf(o, ERROR_MEM, "out of memory");
+  entry = realloc(c->entry, nslots * sizeof(struct countkey));
+  if(!entry) {
+    free(slot);
+    errorf(o, ERROR_MEM, "out of memory");
+  }
+  free(c->slot);
+  c->slot = slot;
+  c->nslots = nslots;
+  c->entry = entry;
+  c->maxentries = nslots; /* the table limits the entries before this */
+  for(i = 0; i < c->nentries; i++) {
+    size_t n = (size_t)c->entry[i].hash & (nslots - 1);
+    while(slot[n])
+      n = (n + 1) & (nslots - 1);
+    slot[n] = i + 1;
+    c->entry[i].slot = n;
+  }
+}
+
+/* a new key without --top */
+static void countadd(struct option *o, size_t n, uint64_t h,
+                     const char *key, size_t len)
+{
+  struct counter *c = o->counter;
+  struct countkey *e;
+  if(c->keyslen + len > c->keyssize) {
+    size_t nsize = c->keyssize ? c->keyssize : OUTBUF_SIZE;
+    char *p;
+    while(nsize < c->keyslen + len)
+      nsize *= 2;
+    p = realloc(c->keys, nsize);
+    if(!p)
+      errorf(o, ERROR_MEM, "out of memory");
+    c->keys = p;
+    c->keyssize = nsize;
+  }
+  memcpy(&c->keys[c->keyslen], key, len);
+  e = &c->entry[c->nentries];
+  e->hash = h;
+  e->count = 1;
+  e->error = 0;
+  e->key = c->keyslen;
+  e->len = len;
+  e->topkey = NULL;
+  e->slot = n;
+  c->slot[n] = ++c->nentries;
+  c->keyslen += len;
+}
+
+static void heapswap(struct counter *c, size_t a, size_t b)
+{
+  struct countkey tmp = c->entry[a];
+  c->entry[a] = c->entry[b];
+  c->entry[b] = tmp;
+  c->slot[c->entry[a].slot] = a + 1;
+  c->slot[c->entry[b].slot] = b + 1;
+}
+
+static void heapdown(struct counter *c, size_t i)
+{
+  for(;;) {
+    size_t least = i;
+    size_t child = 2 * i + 1;
+    if((child < c->nentries) &&
+       (c->entry[child].count < c->entry[least].count))
+      least = child;
+    if((child + 1 < c->nentries) &&
+       (c->entry[child + 1].count < c->entry[least].count))
+      least = child + 1;
+    if(least == i)
+      break;
+    heapswap(c, i, least);
+    i = least;
+  }
+}
+
+/* remove a slot and move up the ones after it that probed past it */
+static void slotremove(struct counter *c, size_t i)
+{
+  size_t mask = c->nslots - 1;
+  size_t j = i;
+  for(;;) {
+    size_t home;
+    c->slot[i] = 0;
+    do {
+      j = (j + 1) & mask;
+      if(!c->slot[j])
+        return;
+      home = (size_t)c->entry[c->slot[j] - 1].hash & mask;
+      /* can the one in j move to i, is its home not in (i, j] */
+    } while((i <= j) ? ((i < home) && (home <= j)) :
+            ((i < home) || (home <= j)));
+    c->slot[i] = c->slot[j];
+    c->entry[c->slot[i] - 1].slot = i;
+    i = j;
+  }
+}
+
+/* a key with --top */
+static void counttop(struct option *o, size_t n, uint64_t h,
+                     const char *key, size_t len)
+{
+  struct counter *c = o->counter;
+  struct countkey *e;
+  char *copy;
+  if(c->slot[n]) {
+    /* counted already, it can only move down in the heap */
+    c->entry[c->slot[n] - 1].count++;
+    heapdown(c, c->slot[n] - 1);
+    return;
+  }
+  copy = malloc(len + 1);
+  if(!copy)
+    errorf(o, ERROR_MEM, "out of memory");
+  memcpy(copy, key, len);
+  copy[len] = 0;
+  if(c->nentries < c->top) {
+    size_t i = c->nentries++;
+    e = &c->entry[i];
+    e->count = 0;
+    e->slot = n;
+    c->slot[n] = i + 1;
+    /* a count of 1 is the lowest there is, so it goes to the top */
+    while(i) {
+      heapswap(c, i, (i - 1) / 2);
+      i = (i - 1) / 2;
+    }
+  }
+  else {
+    /* replace the one with the lowest count */
+    e = &c->entry[0];
+    slotremove(c, e->slot);
+    free(e->topkey);
+    n = countfind(c, h, key, len);
+  }
+  e = &c->entry[0];
+  e->hash = h;
+  e->error = e->count;
+  e->count++;
+  e->topkey = copy;
+  e->len = len;
+  e->slot = n;
+  c->slot[n] = 1;
+  heapdown(c, 0);
+}
+
+/* count the key output since 'mark' and drop that output */
+static void count(struct option *o, size_t mark)
+{
+  struct counter *c = o->counter;
+  const char *key = &o->out.buf[mark];
+  size_t len = o->out.len - mark - 1; /* without the newline */
+  uint64_t h = hash64(key, len);
+  size_t n;
+  o->out.len = mark;
+  if(!c->top && (c->nentries * 10 >= c->nslots * 7))
+    countgrow(o);
+  n = countfind(c, h, key, len);
+  if(c->top)
+    counttop(o, n, h, key, len);
+  else if(c->slot[n])
+    c->entry[c->slot[n] - 1].count++;
+  else
+    countadd(o, n, h, key, len);
+}
+
+/* highest count first, then alphabetical */
+static int countcmp(const void *p1, const void *p2)
+{
+  const struct countkey *a = p1;
+  const struct countkey *b = p2;
+  int rc;
+  if(a->count != b->count)
+    return (a->count < b->count) ? 1 : -1;
+  rc = memcmp(a->topkey, b->topkey, (a->len < b->len) ? a->len : b->len);
+  return rc ? rc : (a->len > b->len) - (a->len < b->len);
+}
+
+/* at exit, output the counts like 'uniq -c' does */
+void trurl_count_show(struct option *o)
+{
+  struct counter *c = o->counter;
+  uint64_t maxerror = 0;
+  size_t i;
+  if(!c->top) {
+    /* the keys do not move anymore, point to them for the sorting */
+    for(i = 0; i < c->nentries; i++)
+      c->entry[i].topkey = &c->keys[c->entry[i].key];
+  }
+  qsort(c->entry, c->nentries, sizeof(struct countkey), countcmp);
+  for(i = 0; i < c->nentries; i++) {
+    struct countkey *e = &c->entry[i];
+    char num[32];
+    curl_msnprintf(num, sizeof(num), "%7" CURL_FORMAT_CURL_OFF_TU " ",
+                   (curl_off_t)e->count);
+    outs(o, num);
+    outn(o, e->topkey, e->len);
+    outc(o, '\n');
+    if(e->error > maxerror)
+      maxerror = e->error;
+    if(o->out.len >= OUTBUF_SIZE)
+      trurl_outflush(o);
+  }
+  trurl_outflush(o);
+  if(maxerror)
+    trurl_warnf(o, "--top: a count can be up to %" CURL_FORMAT_CURL_OFF_TU
+                " too high", (curl_off_t)maxerror);
+}
+
+/*
+ * --cardinality feeds the values of each component into a HyperLogLog
+ * sketch: the low HLL_BITS bits of the hash pick a register, which keeps
+ * the longest run of zero bits seen at the bottom of the rest of the hash.
+ * The estimate has a standard error of 1.04 / sqrt(HLL_REGS), in a fixed
+ * HLL_REGS bytes per component however many values there are.
+ */
+#define HLL_ERROR 0.0081 /* 1.04 / sqrt(HLL_REGS) */
+
+static void hlladd(struct sketch *s, const char *value, size_t len)
+{
+  uint64_t h = hash64(value, len);
+  uint64_t rest = h >> HLL_BITS;
+  unsigned char rank = 1;
+  while(!(rest & 1) && (rank <= 64 - HLL_BITS)) {
+    rest >>= 1;
+    rank++;
+  }
+  if(rank > s->reg[h & (HLL_REGS - 1)])
+    s->reg[h & (HLL_REGS - 1)] = rank;
+}
+
+/* feed the components of this URL into the sketches */
+static void cardinality(struct option *o, CURLU *uh)
+{
+  struct cardinality *c = o->cardinality;
+  const char *format = o->format;
+  size_t i;
+  for(i = 0; i < c->nsketches; i++) {
+    struct sketch *s = &c->sketch[i];
+    if(!s->format) {
+      /* every key in the query */
+      struct string *qp = o->urlencode ? o->qpairs : o->qpairsdec;
+      size_t j;
+      for(j = 0; j < o->nqpairs; j++) {
+        const char *eq = memchr(qp[j].str, '=', qp[j].len);
+        size_t len = eq ? (size_t)(eq - qp[j].str) : qp[j].len;
+        if(len)
+          hlladd(s, qp[j].str, len);
+      }
+    }
+    else {
+      /* get the component like --get does, without showing it */
+      size_t mark = o->out.len;
+      size_t len;
+      o->format = s->format;
+      get(o, uh);
+      len = o->out.len - mark - 1; /* without the newline */
+      if(len)
+        hlladd(s, &o->out.buf[mark], len);
+      o->out.len = mark;
+    }
+  }
+  o->format = format;
+}
+
+/* natural logarithm for x >= 1, to not need libm for a single use */
+static double logn(double x)
+{
+  double r = 0;
+  double y;
+  double y2;
+  double sum = 0;
+  int i;
+  while(x >= 2) {
+    x /= 2;
+    r += 0.69314718055994531;
+  }
+  /* ln(x) = 2 atanh((x - 1) / (x + 1)), y is below 1/3 */
+  y = (x - 1) / (x + 1);
+  y2 = y * y;
+  for(i = 1; i < 40; i += 2) {
+    sum += y / i;
+    y *= y2;
+  }
+  return r + 2 * sum;
+}
+
+static double hllestimate(const unsigned char *reg)
+{
+  double m = HLL_REGS;
+  double sum = 0;
+  double e;
+  size_t zeros = 0;
+  size_t i;
+  for(i = 0; i < HLL_REGS; i++) {
+    sum += 1.0 / (double)((uint64_t)1 << reg[i]);
+    if(!reg[i])
+      zeros++;
+  }
+  e = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+  if((e <= 2.5 * m) && zeros)
+    /* few values, linear counting on the empty registers is better */
+    e = m * logn(m / (double)zeros);
+  return e;
+}
+
+/* at exit, output the estimates with a 95% error bound */
+void trurl_cardinality_show(struct option *o)
+{
+  struct cardinality *c = o->cardinality;
+  size_t i;
+  for(i = 0; i < c->nsketches; i++) {
+    double e = hllestimate(c->sketch[i].reg);
+    char line[256];
+    curl_msnprintf(line, sizeof(line), "%s: %" CURL_FORMAT_CURL_OFF_TU
+                   " +- %" CURL_FORMAT_CURL_OFF_TU "\n", c->sketch[i].name,
+                   (curl_off_t)(e + 0.5),
+                   (curl_off_t)(e * HLL_ERROR * 2 + 0.5));
+    outs(o, line);
+  }
+  trurl_outflush(o);
+}
+
+/*
+ * --where compiles the expression once into a tree of nodes:
+ *
+ *   expr := and ['||' and]...
+ *   and  := not ['&&' not]...
+ *   not  := '!' not | '(' expr ')' | component op value | component exists
+ *   op   := '==' | '!=' | '~' | '!~'
+ *
+ * The component is given like in --get and the value is a word or a
+ * double quoted string. '~' matches the value as a pattern where '*' is any
+ * number of characters and '?' is one. A URL gets only the components the
+ * expression needs to decide, as '&&' and '||' stop early.
+ */
+struct whereparse {
+  struct option *o;
+  const char *p; /* the rest of the expression */
+  unsigned int depth; /* '!' and '(' being parsed */
+};
+
+/* both the parser and whereeval() recurse as deep as the expression nests */
+#define WHERE_DEPTH 1000
+
+TRURL_NORETURN static void wherebad(struct whereparse *wp)
+{
+  if(*wp->p)
+    errorf(wp->o, ERROR_FLAG, "Bad --where syntax at: %s", wp->p);
+  errorf(wp->o, ERROR_FLAG, "Bad --where syntax: the expression ends early");
+}
+
+static bool wheretoken(struct whereparse *wp, const char *token)
+{
+  size_t len = strlen(token);
+  while((*wp->p == ' ') || (*wp->p == '\t'))
+    wp->p++;
+  if(strncmp(wp->p, token, len))
+    return false;
+  wp->p += len;
+  return true;
+}
+
+/* a component name or an unquoted value */
+static size_t whereword(struct whereparse *wp)
+{
+  size_t len = strcspn(wp->p, " \t()!=~&|\"");
+  if(!len)
+    wherebad(wp);
+  return len;
+}
+
+static size_t whereadd(struct whereparse *wp, enum whereop op)
+{
+  struct where *w = wp->o->where;
+  struct wherenode *node = realloc(w->node, (w->nnodes + 1) *
+                                   sizeof(struct wherenode));
+  if(!node)
+    errorf(wp->o, ERROR_MEM, "out of memory");
+  w->node = node;
+  memset(&node[w->nnodes], 0, sizeof(struct wherenode));
+  node[w->nnodes].op = op;
+  return w->nnodes++;
+}
+
+TRURL_NORETURN static void wheredeep(struct whereparse *wp)
+{
+  errorf(wp->o, ERROR_FLAG, "--where nests deeper than %d levels",
+         WHERE_DEPTH);
+}
+
+/* an operator node, the right operand is not used for NOT */
+static size_t wherejoin(struct whereparse *wp, enum whereop op, size_t left,
+                        size_t right)
+{
+  size_t n = whereadd(wp, op);
+  struct wherenode *node = wp->o->where->node;
+  unsigned int depth = node[left].depth;
+  if((op != WHERE_NOT) && (node[right].depth > depth))
+    depth = node[right].depth;
+  if(depth >= WHERE_DEPTH)
+    wheredeep(wp);
+  node[n].left = left;
+  node[n].right = right;
+  node[n].depth = depth + 1;
+  return n;
+}
+
+/* the modifiers --get allows in front of a component */
+static const char *const wheremods[] = {
+  "default:", "puny:", "idn:", "strict:", "must:", "url:", NULL
+};
+
+static void wherecomponent(struct whereparse *wp, struct wherenode *n,
+                           const char *name, size_t len)
+{
+  const char *p = name;
+  size_t plen = len;
+  int i = 0;
+  if(*p == ':') {
+    p++;
+    plen--;
+  }
+  while(wheremods[i]) {
+    size_t mlen = strlen(wheremods[i]);
+    if((plen > mlen) && !strncmp(p, wheremods[i], mlen)) {
+      p += mlen;
+      plen -= mlen;
+      i = 0;
+    }
+    else
+      i++;
+  }
+  if((plen > 6) && !strncmp(p, "query:", 6)) {
+    n->qkey = &p[6];
+    n->qkeylen = plen - 6;
+  }
+  else if((plen > 10) && !strncmp(p, "query-all:", 10)) {
+    n->qkey = &p[10];
+    n->qkeylen = plen - 10;
+  }
+  else if(((plen == 7) && !strncmp(p, "ipclass", 7)) ||
+          ((plen == 6) && !strncmp(p, "suffix", 6)) ||
+          ((plen == 11) && !strncmp(p, "registrable", 11)))
+    n->computed = true;
+  else if((plen != 3) || strncmp(p, "url", 3)) {
+    n->var = comp2var(p, plen);
+    if(!n->var)
+      errorf(wp->o, ERROR_FLAG, "\"%.*s\" is not a recognized URL component",
+             (int)plen, p);
+  }
+  n->format = curl_maprintf("{%.*s}", (int)len, name);
+  if(!n->format)
+    errorf(wp->o, ERROR_MEM, "out of memory");
+}
+
+/* a double quoted string with backslash escapes, or a word */
+static void wherevalue(struct whereparse *wp, size_t n)
+{
+  struct wherenode *node = &wp->o->where->node[n];
+  const char *start;
+  bool quoted;
+  size_t len;
+  char *v;
+  size_t i;
+  wheretoken(wp, ""); /* skip the blanks */
+  quoted = (*wp->p == '\"');
+  if(quoted) {
+    start = ++wp->p;
+    while(*wp->p && (*wp->p != '\"')) {
+      if((*wp->p == '\\') && wp->p[1])
+        wp->p++;
+      wp->p++;
+    }
+    if(!*wp->p)
+      wherebad(wp);
+    len = wp->p++ - start; /* pass the quote */
+  }
+  else {
+    start = wp->p;
+    len = whereword(wp);
+    wp->p += len;
+  }
+  node->value = v = curl_maprintf("%.*s", (int)len, start);
+  if(!v)
+    errorf(wp->o, ERROR_MEM, "out of memory");
+  for(i = 0; quoted && (i < len); i++) {
+    if(start[i] == '\\')
+      i++;
+    *v++ = start[i];
+  }
+  node->vlen = quoted ? (size_t)(v - node->value) : len;
+}
+
+static size_t whereor(struct whereparse *wp);
+
+static size_t wherenot(struct whereparse *wp)
+{
+  size_t n;
+  if(wheretoken(wp, "!")) {
+    if(++wp->depth > WHERE_DEPTH)
+      wheredeep(wp);
+    n = wherejoin(wp, WHERE_NOT, wherenot(wp), 0);
+    wp->depth--;
+  }
+  else if(wheretoken(wp, "(")) {
+    if(++wp->depth > WHERE_DEPTH)
+      wheredeep(wp);
+    n = whereor(wp);
+    if(!wheretoken(wp, ")"))
+      wherebad(wp);
+    wp->depth--;
+  }
+  else {
+    const char *name = wp->p;
+    size_t len = whereword(wp);
+    wp->p += len;
+    if(wheretoken(wp, "exists"))
+      n = whereadd(wp, WHERE_EXISTS);
+    else {
+      if(wheretoken(wp, "=="))
+        n = whereadd(wp, WHERE_EQ);
+      else if(wheretoken(wp, "!="))
+        n = whereadd(wp, WHERE_NE);
+      else if(wheretoken(wp, "!~"))
+        n = whereadd(wp, WHERE_NOMATCH);
+      else if(wheretoken(wp, "~"))
+        n = whereadd(wp, WHERE_MATCH);
+      else
+        wherebad(wp);
+      wherevalue(wp, n);
+    }
+    wherecomponent(wp, &wp->o->where->node[n], name, len);
+  }
+  return n;
+}
+
+static size_t whereand(struct whereparse *wp)
+{
+  size_t left = wherenot(wp);
+  while(wheretoken(wp, "&&")) {
+    size_t right = wherenot(wp);
+    left = wherejoin(wp, WHERE_AND, left, right);
+  }
+  return left;
+}
+
+static size_t whereor(struct whereparse *wp)
+{
+  size_t left = whereand(wp);
+  while(wheretoken(wp, "||")) {
+    size_t right = whereand(wp);
+    left = wherejoin(wp, WHERE_OR, left, right);
+  }
+  return left;
+}
+
+static void wherecompile(struct option *o)
+{
+  struct whereparse wp;
+  o->where = calloc(1, sizeof(struct where));
+  if(!o->where)
+    errorf(o, ERROR_MEM, "out of memory");
+  wp.o = o;
+  wp.p = o->whereexpr;
+  wp.depth = 0;
+  o->where->root = whereor(&wp);
+  if(!wheretoken(&wp, "") || *wp.p)
+    wherebad(&wp);
+}
+
+/* '*' matches any number of characters, '?' a single one */
+static bool wherematch(const char *pat, size_t plen, const char *str,
+                       size_t slen)
+{
+  size_t p = 0;
+  size_t s = 0;
+  size_t star = plen; /* no star seen */
+  size_t retry = 0;
+  while(s < slen) {
+    if((p < plen) && (pat[p] == '*')) {
+      /* first try to match nothing, then one more each time */
+      star = p++;
+      retry = s;
+    }
+    else if((p < plen) && ((pat[p] == '?') || (pat[p] == str[s]))) {
+      p++;
+      s++;
+    }
+    else if(star < plen) {
+      p = star + 1;
+      s = ++retry;
+    }
+    else
+      return false;
+  }
+  while((p < plen) && (pat[p] == '*'))
+    p++;
+  return p == plen;
+}
+
+static bool whereexists(struct option *o, CURLU *uh, struct wherenode *n)
+{
+  if(n->qkey) {
+    struct string *qp = o->urlencode ? o->qpairs : o->qpairsdec;
+    size_t i;
+    for(i = 0; i < o->nqpairs; i++) {
+      if((qp[i].len >= n->qkeylen) &&
+         !strncmp(qp[i].str, n->qkey, n->qkeylen) &&
+         ((qp[i].len == n->qkeylen) || (qp[i].str[n->qkeylen] == '=')))
+        return true;
+    }
+    return false;
+  }
+  if(n->var) {
+    char *part;
+    if(geturlpart(o, 0, uh, n->var->part, &part))
+      return false;
+    curl_free(part);
+  }
+  else if(n->computed) {
+    /* these exist when they are not empty */
+    const char *format = o->format;
+    size_t mark = o->out.len;
+    bool exists;
+    o->format = n->format;
+    get(o, uh);
+    o->format = format;
+    exists = (o->out.len - mark > 1); /* more than the newline */
+    o->out.len = mark;
+    return exists;
+  }
+  return true;
+}
+
+static bool whereeval(struct option *o, CURLU *uh, size_t i)
+{
+  struct wherenode *n = &o->where->node[i];
+  const char *format;
+  size_t mark;
+  const char *value;
+  size_t len;
+  bool match;
+  switch(n->op) {
+  case WHERE_OR:
+    return whereeval(o, uh, n->left) || whereeval(o, uh, n->right);
+  case WHERE_AND:
+    return whereeval(o, uh, n->left) && whereeval(o, uh, n->right);
+  case WHERE_NOT:
+    return !whereeval(o, uh, n->left);
+  case WHERE_EXISTS:
+    return whereexists(o, uh, n);
+  default:
+    break;
+  }
+  /* get the component like --get does, without showing it */
+  format = o->format;
+  mark = o->out.len;
+  o->format = n->format;
+  get(o, uh);
+  o->format = format;
+  value = &o->out.buf[mark];
+  len = o->out.len - mark - 1; /* without the newline */
+  if((n->op == WHERE_EQ) || (n->op == WHERE_NE))
+    match = (len == n->vlen) && !memcmp(value, n->value, len);
+  else
+    match = wherematch(n->value, n->vlen, value, len);
+  o->out.len = mark;
+  return ((n->op == WHERE_EQ) || (n->op == WHERE_MATCH)) ? match : !match;
+}
+
+/* hostslot() needs a free slot to stop at and the node numbers and labels
+   have to be within the list, which a list built by hostadd() has */
+static bool hostsvalid(const struct hostlist *l)
+{
+  size_t used = 0;
+  size_t i;
+  if(!l->nodes || ((uint64_t)l->nodes * 10 >= (uint64_t)l->nslots * 7))
+    return false;
+  for(i = 0; i < l->nslots; i++) {
+    const struct hostnode *e = &l->slot[i];
+    if(!e->node)
+      continue;
+    if((e->node >= l->nodes) || (e->parent >= l->nodes) ||
+       ((uint64_t)e->label + e->len > l->labelslen))
+      return false;
+    used++;
+  }
+  return used == l->nodes - 1; /* all but the root */
+}
+
+/* a precompiled list, mapped as it is */
+static void hostsmap(struct option *o, struct hostlist *l, FILE *f)
+{
+  const unsigned char *head;
+  uint32_t order;
+  uint32_t nodes;
+  uint64_t nslots;
+  uint64_t labelslen;
+#ifndef _WIN32
+  struct stat st;
+  if(fstat(fileno(f), &st))
+    errorf(o, ERROR_FILE, "%s %s: %s", l->flag, l->file, strerror(errno));
+  l->maplen = (size_t)st.st_size;
+  if(l->maplen >= HOSTS_HEADER) {
+    void *map = mmap(NULL, l->maplen, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+    if(map == MAP_FAILED)
+      errorf(o, ERROR_FILE, "%s %s: %s", l->flag, l->file, strerror(errno));
+    l->map = map;
+  }
+#else
+  /* no mmap(), read it all instead */
+  if(!fseek(f, 0, SEEK_END)) {
+    long size = ftell(f);
+    if((size >= HOSTS_HEADER) && !fseek(f, 0, SEEK_SET)) {
+      l->maplen = (size_t)size;
+      l->map = malloc(l->maplen);
+      if(!l->map)
+        errorf(o, ERROR_MEM, "out of memory");
+      if(fread(l->map, 1, l->maplen, f) != l->maplen)
+        l->maplen = 0;
+    }
+  }
+#endif
+  fclose(f);
+  head = l->map;
+  if(!head || (l->maplen < HOSTS_HEADER))
+    errorf(o, ERROR_FILE, "%s %s: truncated", l->flag, l->file);
+  memcpy(&order, &head[8], 4);
+  memcpy(&nodes, &head[12], 4);
+  memcpy(&nslots, &head[16], 8);
+  memcpy(&labelslen, &head[24], 8);
+  if(order != HOSTS_ORDER)
+    errorf(o, ERROR_FILE, "%s %s: made on another kind of machine",
+           l->flag, l->file);
+  if(!nslots || (nslots & (nslots - 1)) ||
+     (nslots > (l->maplen - HOSTS_HEADER) / sizeof(struct hostnode)) ||
+     (labelslen != l->maplen - HOSTS_HEADER -
+      nslots * sizeof(struct hostnode)))
+    errorf(o, ERROR_FILE, "%s %s: truncated", l->flag, l->file);
+  l->nodes = nodes;
+  l->nslots = (size_t)nslots;
+  l->slot = (struct hostnode *)((char *)l->map + HOSTS_HEADER);
+  l->labels = (char *)&l->slot[l->nslots];
+  l->labelslen = (size_t)labelslen;
+  if(!hostsvalid(l))
+    errorf(o, ERROR_FILE, "%s %s: damaged", l->flag, l->file);
+}
+
+static void hostsload(struct option *o, struct hostlist *l)
+{
+  char line[MAX_HOST_LINE];
+  unsigned long lineno = 0;
+  FILE *f = fopen(l->file, "rb");
+  if(!f)
+    errorf(o, ERROR_FILE, "%s %s not found", l->flag, l->file);
+  if((fread(line, 1, 8, f) == 8) && !memcmp(line, HOSTS_MAGIC, 8)) {
+    hostsmap(o, l, f);
+    return;
+  }
+  rewind(f);
+  l->nodes = 1; /* the root */
+  hostsgrow(o, l);
+  while(fgets(line, sizeof(line), f)) {
+    char *name = line;
+    size_t len;
+    size_t i;
+    size_t label = 0;
+    lineno++;
+    if(!strchr(line, '\n') && !feof(f)) {
+      /* too long, skip the rest */
+      int ch;
+      do {
+        ch = getc(f);
+      } while((ch != EOF) && (ch != '\n'));
+      trurl_warnf(o, "%s %s:%lu: skipping long line", l->flag, l->file,
+                  lineno);
+      continue;
+    }
+    while((*name == ' ') || (*name == '\t'))
+      name++;
+    len = strcspn(name, " \t\r\n#");
+    /* "*.example.com" and ".example.com" are like "example.com" */
+    if((len > 1) && (name[0] == '*') && (name[1] == '.')) {
+      name++;
+      len--;
+    }
+    if(len && (name[0] == '.')) {
+      name++;
+      len--;
+    }
+    if(len && (name[len - 1] == '.'))
+      len--;
+    if(!len)
+      continue;
+    for(i = 0; i < len; i++) {
+      if(name[i] == '.') {
+        if(!label)
+          break;
+        label = 0;
+      }
+      else {
+        if(ISUPPER(name[i]))
+          name[i] |= ('a' - 'A');
+        label++;
+      }
+      if(label > MAX_LABEL)
+        break;
+    }
+    if(i < len)
+      trurl_warnf(o, "%s %s:%lu: skipping bad host name", l->flag, l->file,
+                  lineno);
+    else
+      hostadd(o, l, name, len, 1);
+  }
+  if(ferror(f))
+    errorf(o, ERROR_FILE, "%s %s: %s", l->flag, l->file, strerror(errno));
+  fclose(f);
+}
+
+static bool hostsmatch(const struct hostlist *l, const char *host, size_t len)
+{
+  uint32_t parent = 0;
+  char label[MAX_LABEL];
+  if(len && (host[len - 1] == '.'))
+    len--;
+  while(len) {
+    size_t start = len;
+    size_t llen;
+    size_t i;
+    size_t n;
+    while(start && (host[start - 1] != '.'))
+      start--;
+    llen = len - start;
+    if(!llen || (llen > MAX_LABEL))
+      return false;
+    for(i = 0; i < llen; i++) {
+      char c = host[start + i];
+      label[i] = ISUPPER(c) ? (char)(c | ('a' - 'A')) : c;
+    }
+    n = hostslot(l, parent, label, llen);
+    if(!l->slot[n].node)
+      return false;
+    if(l->slot[n].end)
+      return true;
+    parent = l->slot[n].node;
+    len = start ? start - 1 : 0;
+  }
+  return false;
+}
+
+static bool hostsallowed(struct option *o, const char *host, size_t len)
+{
+  if(o->only && !hostsmatch(o->only, host, len))
+    return false;
+  return !o->exclude || !hostsmatch(o->exclude, host, len);
+}
+
+/* --exclude-hosts, --only-hosts and --where-ip */
+static bool hostsurl(struct option *o, CURLU *uh)
+{
+  char *host;
+  bool allowed;
+  if(curl_url_get(uh, CURLUPART_HOST, &host, 0))
+    return hostsallowed(o, "", 0);
+  allowed = hostsallowed(o, host, strlen(host)) &&
+    (!o->whereip || ipallowed(o, host, strlen(host)));
+  curl_free(host);
+  return allowed;
+}
+
+/* --compile-hosts, save the list for hostsmap() */
+void trurl_hosts_save(struct option *o)
+{
+  struct hostlist *l = o->exclude ? o->exclude : o->only;
+  unsigned char head[HOSTS_HEADER];
+  uint32_t order = HOSTS_ORDER;
+  uint64_t nslots = l->nslots;
+  uint64_t labelslen = l->labelslen;
+  const char *file = o->compilehosts;
+  bool fail;
+  FILE *f;
+  memcpy(head, HOSTS_MAGIC, 8);
+  memcpy(&head[8], &order, 4);
+  memcpy(&head[12], &l->nodes, 4);
+  memcpy(&head[16], &nslots, 8);
+  memcpy(&head[24], &labelslen, 8);
+  f = fopen(file, "wb");
+  if(!f)
+    errorf(o, ERROR_FILE, "--compile-hosts %s: %s", file, strerror(errno));
+  fail = (fwrite(head, 1, HOSTS_HEADER, f) != HOSTS_HEADER) ||
+    (fwrite(l->slot, sizeof(struct hostnode), l->nslots, f) != l->nslots) ||
+    (fwrite(l->labels, 1, l->labelslen, f) != l->labelslen);
+  fail |= !!fclose(f);
+  if(fail)
+    errorf(o, ERROR_FILE, "--compile-hosts %s: %s", file, strerror(errno));
+}
+
+#ifndef TRURL_NO_FASTPATH
+/* offsets of the components in a URL split up by fastparse() */
+struct fastparts {
+  size_t host;     /* offset of the host, right after the "://" */
+  size_t hostlen;
+  size_t port;     /* offset of the port number, 0 if none */
+  size_t path;     /* offset of the path (or of whatever follows the host) */
+  size_t pathlen;  /* zero when there is no path */
+  size_t query;    /* offset of the query, 0 if none */
+  size_t pairs;    /* number of query pairs */
+  size_t fragment; /* offset of the fragment, 0 if none */
+  size_t len;      /* full URL length */
+};
+
+/* letters that URL encoding leaves alone in paths and fragments */
+#define ISPLAIN(x) (ISALNUM(x) || ((x) == '-') || ((x) == '.') || \
+                    ((x) == '_') || ((x) == '~'))
+
+/*
+ * fastparse() splits up a plain ASCII http or https URL that is already in
+ * its normalized form, which means that libcurl and trurl's normalization
+ * would output it unchanged. Everything else returns false, to be handed
+ * over to libcurl.
+ */
+static bool fastparse(const char *url, struct fastparts *f)
+{
+  const char *p;
+  const char *host;
+  const char *seg;
+  bool letter = false;
+  unsigned int defport;
+
+  memset(f, 0, sizeof(*f));
+  if(!strncmp(url, "http://", 7)) {
+    p = &url[7];
+    defport = 80;
+  }
+  else if(!strncmp(url, "https://", 8)) {
+    p = &url[8];
+    defport = 443;
+  }
+  else
+    return false;
+
+  /* lowercase hostname with non-empty labels, of which at least one starts
+     with a letter so that it cannot be a numerical IPv4 address */
+  seg = host = p;
+  while(ISLOWER(*p) || ISDIGIT(*p) || (*p == '-') || (*p == '.')) {
+    if(*p == '.') {
+      if(p == seg)
+        return false;
+      seg = p + 1;
+    }
+    else if((p == seg) && ISLOWER(*p))
+      letter = true;
+    p++;
+  }
+  f->host = host - url;
+  f->hostlen = p - host;
+  if(!f->hostlen || (f->hostlen > 253) || (p == seg) || !letter)
+    return false;
+
+  if(*p == ':') {
+    /* a port number without leading zeroes that is not the default one */
+    unsigned int port = 0;
+    size_t digits = 0;
+    f->port = ++p - url;
+    if(!ISDIGIT(*p) || (*p == '0'))
+      return false;
+    while(ISDIGIT(*p) && (digits < 5)) {
+      port = port * 10 + (unsigned int)(*p++ - '0');
+      digits++;
+    }
+    if((port > 65535) || (port == defport))
+      return false;
+  }
+
+  f->path = p - url;
+  if(*p == '/') {
+    /* no dot segments */
+    seg = p;
+    do {
+      p++;
+      if(!*p || (*p == '/') || (*p == '?') || (*p == '#')) {
+        size_t slen = p - seg - 1;
+        if(((slen == 1) && (seg[1] == '.')) ||
+           ((slen == 2) && (seg[1] == '.') && (seg[2] == '.')))
+          return false;
+        seg = p;
+      }
+      else if(!ISPLAIN(*p))
+        return false;
+    } while(*p == '/' || ISPLAIN(*p));
+    f->pathlen = p - url - f->path;
+  }
+
+  if(*p == '?') {
+    /* non-empty pairs with at most one equals sign each, and not more of
+       them than libcurl's path stores without a warning */
+    bool assign = false;
+    f->query = ++p - url;
+    f->pairs = 1;
+    seg = p;
+    for(; *p && (*p != '#'); p++) {
+      if(*p == '&') {
+        if((p == seg) || (++f->pairs > MAX_QPAIRS))
+          return false;
+        seg = p + 1;
+        assign = false;
+      }
+      else if(*p == '=') {
+        if(assign)
+          return false;
+        assign = true;
+      }
+      else if(!ISPLAIN(*p) && (*p != '*'))
+        return false;
+    }
+    if(p == seg)
+      return false;
+  }
+
+  if(*p == '#') {
+    f->fragment = ++p - url;
+    if(!*p)
+      return false;
+    while(ISPLAIN(*p))
+      p++;
+  }
+
+  f->len = p - url;
+  return !*p;
+}
+
+/*
+ * Output the URL directly if it is fine as-is and no option asks for
+ * anything else than the default output. Returns true if done.
+ */
+static bool fastpath(struct option *o, const char *url)
+{
+  struct fastparts f;
+  size_t mark = o->out.len;
+  if(!fastparse(url, &f))
+    return false;
+  if((o->exclude || o->only) && !hostsallowed(o, &url[f.host], f.hostlen))
+    return true; /* filtered out */
+
+#ifdef HAVE_PROBES
+  o->nqpairs = f.pairs; /* only counted, none are stored */
+#endif
+  PROBE(parsed, o);
+  STAGE(o, STAGE_FORMAT);
+  if(f.pathlen)
+    outn(o, url, f.len);
+  else {
+    /* libcurl always provides a path */
+    outn(o, url, f.path);
+    outc(o, '/');
+    outn(o, &url[f.path], f.len - f.path);
+  }
+  outc(o, '\n');
+  o->urls++;
+  if(!o->unique || unique(o, mark)) {
+    PROBE(output, o);
+    if(o->stats)
+      o->stats->out++;
+  }
+#ifdef HAVE_PROBES
+  o->nqpairs = 0;
+#endif
+  return true;
+}
+#endif
+
+/* normalize, do the query operations and output the URL */
+static void transform(struct option *o, CURLU *uh, const char *url)
+{
+  struct curl_slist *p;
+  bool url_is_invalid = false;
+  bool query_is_modified = false;
+  size_t mark;
+
+  STAGE(o, STAGE_NORMALIZE);
+  {
+    /* extract the current path */
+    char *opath;
+    char *cpath;
+    bool path_is_modified = false;
+    if(curl_url_get(uh, CURLUPART_PATH, &opath, 0))
+      errorf(o, ERROR_MEM, "out of memory");
+
+    /* append path segments */
+    for(p = o->append_path; p; p = p->next) {
+      char *apath = p->data;
+      char *npath;
+      size_t olen;
+
+      /* does the existing path end with a slash, then don't
+         add one in between */
+      olen = strlen(opath);
+
+      /* append the new segment */
+      npath = curl_maprintf("%s%s%s", opath,
+                            opath[olen - 1] == '/' ? "" : "/", apath);
+      curl_free(opath);
+      opath = npath;
+      path_is_modified = true;
+    }
+    cpath = canonical_path(opath);
+    if(!cpath)
+      errorf(o, ERROR_MEM, "out of memory");
+
+    if(strcmp(cpath, opath)) {
+      /* updated */
+      path_is_modified = true;
+      curl_free(opath);
+      opath = cpath;
+    }
+    else
+      curl_free(cpath);
+    if(path_is_modified) {
+      /* set the new path */
+      if(curl_url_set(uh, CURLUPART_PATH, opath, 0))
+        errorf(o, ERROR_MEM, "out of memory");
+    }
+    curl_free(opath);
+
+    normalize_part(o, uh, CURLUPART_FRAGMENT);
+    normalize_part(o, uh, CURLUPART_USER);
+    normalize_part(o, uh, CURLUPART_PASSWORD);
+    normalize_part(o, uh, CURLUPART_OPTIONS);
+  }
+  PROBE(normalized, o);
+
+  STAGE(o, STAGE_QUERY);
+  query_is_modified |= extractqpairs(uh, o);
+
+  /* trim parts */
+  query_is_modified |= trim(o);
+
+  /* replace parts */
+  query_is_modified |= replace(o);
+
+  /* append query segments */
+  for(p = o->append_query; p; p = p->next) {
+    addqpair(o, p->data, strlen(p->data), o->jsonout);
+    query_is_modified = true;
+  }
+
+  /* sort query */
+  query_is_modified |= sortquery(o);
+
+  /* put the query back */
+  if(query_is_modified)
+    qpair2query(uh, o);
+  PROBE(query, o);
+
+  /* make sure the URL is still valid */
+  if(!url || o->redirect || o->set_list || o->append_path) {
+    CURLUcode rc;
+    STAGE(o, STAGE_PARSE);
+    /* kept in the struct, an error in library mode long jumps away and
+       leaves it to urlcleanup() */
+    rc = curl_url_get(uh, CURLUPART_URL, &o->ourl, 0);
+    if(rc) {
+      verify(o, ERROR_URL, "not enough input for a URL");
+      url_is_invalid = true;
+    }
+    else {
+      rc = seturl(o, uh, o->ourl);
+      if(rc) {
+        failure(o, rc);
+        verify(o, ERROR_BADURL, "%s [%s]", curl_url_strerror(rc), o->ourl);
+        url_is_invalid = true;
+      }
+      else {
+        char *nurl = NULL;
+        rc = curl_url_get(uh, CURLUPART_URL, &nurl, 0);
+        if(!rc)
+          curl_free(nurl);
+        else {
+          failure(o, rc);
+          verify(o, ERROR_BADURL, "url became invalid");
+          url_is_invalid = true;
+        }
+      }
+      curl_free(o->ourl);
+      o->ourl = NULL;
+    }
+  }
+
+  STAGE(o, STAGE_FORMAT);
+  if(!url_is_invalid &&
+     (((o->exclude || o->only || o->whereip) && !hostsurl(o, uh)) ||
+      (o->where && !whereeval(o, uh, o->where->root)))) {
+    /* filtered out, nothing is output for it */
+    freeqpairs(o);
+    return;
+  }
+  mark = o->out.len;
+  if(url_is_invalid)
+    ;
+  else if(o->cardinality)
+    cardinality(o, uh);
+  else if(o->jsonout)
+    json(o, uh);
+  else if(o->format) {
+    /* custom output format */
+    get(o, uh);
+  }
+  else {
+    /* default output is full URL */
+    char *nurl = NULL;
+    CURLUcode rc = geturlpart(o, 0, uh, CURLUPART_URL, &nurl);
+    if(!rc) {
+      outs(o, nurl);
+      outc(o, '\n');
+      curl_free(nurl);
+    }
+  }
+  if(o->counter) {
+    if(!url_is_invalid)
+      count(o, mark);
+  }
+  else if(o->cardinality)
+    ; /* nothing is output */
+  else if(!url_is_invalid && (!o->unique || unique(o, mark))) {
+    if(o->stats)
+      o->stats->out++;
+    PROBE(output, o);
+  }
+
+  freeqpairs(o);
+
+  o->urls++;
+
+  /* do not let a long --iterate series pile up */
+  if(o->out.len >= OUTBUF_SIZE) {
+    trurl_outflush(o);
+    o->memoskip = true; /* the output is not all there */
+  }
+}
+
+/* one URL, or none, and what --iterate makes out of it */
+static void singleurl(struct option *o, const char *url)
+{
+  CURLU *uh;
+  unsigned int setmask;
+  size_t i;
+#ifndef TRURL_NO_FASTPATH
+  if(o->fastpath && url && fastpath(o, url))
+    return;
+#endif
+  /* kept in 'o' to get cleaned up on errors */
+  uh = o->uh = curl_url();
+  if(!uh)
+    errorf(o, ERROR_MEM, "out of memory");
+  if(url) {
+    CURLUcode rc = seturl(o, uh, url);
+    if(rc) {
+      urlcleanup(o);
+      failure(o, rc);
+      verify(o, ERROR_BADURL, "%s [%s]", curl_url_strerror(rc), url);
+      return;
+    }
+    if(o->redirect) {
+      rc = seturl(o, uh, o->redirect);
+      if(rc) {
+        urlcleanup(o);
+        failure(o, rc);
+        verify(o, ERROR_BADURL, "invalid redirection: %s [%s]",
+               curl_url_strerror(rc), o->redirect);
+        return;
+      }
+    }
+  }
+  PROBE(parsed, o);
+
+  /* set everything */
+  setmask = set(uh, o);
+
+  if(!o->niters) {
+    transform(o, uh, url);
+    urlcleanup(o);
+    return;
+  }
+
+  /* --iterate works like an odometer: the last iterator advances for every
+     output and when one wraps around, the one before it advances. Only the
+     components that changed are updated in 'uh', the rest of the work is
+     done on a copy of it. */
+  for(i = 0; i < o->niters; i++) {
+    struct iterinfo *it = &o->iters[i];
+    if(setmask & (1 << it->v->part))
+      errorf(o, ERROR_ITER,
+             "duplicate --iterate and --set for component %s", it->v->name);
+    iterfirst(o, it);
+    setcomponent(o, uh, it->v, it->value, it->urlencode);
+  }
+  do {
+    o->work = curl_url_dup(uh);
+    if(!o->work)
+      errorf(o, ERROR_MEM, "out of memory");
+    transform(o, o->work, url);
+    curl_url_cleanup(o->work);
+    o->work = NULL;
+
+    /* advance */
+    i = o->niters;
+    while(i--) {
+      struct iterinfo *it = &o->iters[i];
+      bool more = iternext(o, it);
+      if(!more)
+        /* wrap around and let the previous one advance */
+        iterfirst(o, it);
+      setcomponent(o, uh, it->v, it->value, it->urlencode);
+      if(more)
+        break;
+    }
+  } while(i < o->niters); /* 'i' wraps when the first one wrapped */
+  urlcleanup(o);
+}
+
+static void memoevict(struct memo *m)
+{
+  for(;;) {
+    struct memoentry *e = &m->entry[m->hand];
+    uint32_t n = m->hand + 1;
+    uint32_t *p;
+    m->hand = (m->hand + 1) & (m->nentries - 1);
+    if(!e->data)
+      continue;
+    if(e->used) {
+      /* a second chance */
+      e->used = false;
+      continue;
+    }
+    p = &m->bucket[e->hash & (m->nentries - 1)];
+    while(*p != n)
+      p = &m->entry[*p - 1].chain;
+    *p = e->chain;
+    free(e->data);
+    e->data = NULL;
+    m->bytes -= (size_t)e->linelen + e->outlen;
+    e->chain = m->free;
+    m->free = n;
+    return;
+  }
+}
+
+/* keep the output from 'mark' on for the line */
+static void memoadd(struct option *o, const char *line, size_t linelen,
+                    uint64_t hash, size_t mark, unsigned int urls)
+{
+  struct memo *m = o->memo;
+  size_t outlen = o->out.len - mark;
+  size_t need = linelen + outlen;
+  struct memoentry *e;
+  uint32_t *b;
+  uint32_t n;
+  if(need > m->maxbytes / 16)
+    return; /* it would push out too much */
+  while(!m->free || (m->bytes + need > m->maxbytes))
+    memoevict(m);
+  n = m->free;
+  e = &m->entry[n - 1];
+  e->data = malloc(need);
+  if(!e->data)
+    errorf(o, ERROR_MEM, "out of memory");
+  m->free = e->chain;
+  memcpy(e->data, line, linelen);
+  memcpy(&e->data[linelen], &o->out.buf[mark], outlen);
+  e->hash = hash;
+  e->linelen = (uint32_t)linelen;
+  e->outlen = (uint32_t)outlen;
+  e->urls = urls;
+  e->used = false;
+  b = &m->bucket[hash & (m->nentries - 1)];
+  e->chain = *b;
+  *b = n;
+  m->bytes += need;
+}
+
+/* --memo, a line seen before gets the output it got then */
+static void memourl(struct option *o, const char *url)
+{
+  struct memo *m = o->memo;
+  size_t len = strlen(url);
+  uint64_t h = hash64(url, len);
+  size_t mark = o->out.len;
+  unsigned int urls = o->urls;
+  uint32_t n;
+  for(n = m->bucket[h & (m->nentries - 1)]; n; n = m->entry[n - 1].chain) {
+    struct memoentry *e = &m->entry[n - 1];
+    if((e->hash == h) && (e->linelen == len) && !memcmp(e->data, url, len)) {
+      m->hits++;
+      e->used = true;
+      STAGE(o, STAGE_FORMAT);
+      if(e->outlen) {
+        if(o->jsonout && o->urls)
+          outc(o, ',');
+        outn(o, &e->data[len], e->outlen);
+      }
+      o->urls += e->urls;
+      if(o->stats)
+        o->stats->out += e->urls;
+      return;
+    }
+  }
+  m->misses++;
+  o->memoskip = false;
+  singleurl(o, url);
+  if(!o->memoskip && (len <= UINT32_MAX)) {
+    /* --json separates from the previous URL with a comma, which the
+       output of the line does not include */
+    if(o->jsonout && urls && (o->out.len > mark))
+      mark++;
+    memoadd(o, url, len, h, mark, o->urls - urls);
+  }
+}
+
+void trurl_singleurl(struct option *o,
+                     const char *url) /* might be NULL */
+{
+  if(o->stats && url) {
+    o->stats->in++;
+    STAGE(o, STAGE_PARSE);
+  }
+#ifdef HAVE_PROBES
+  o->urllen = url ? strlen(url) : 0;
+#endif
+  if(o->memo && url)
+    memourl(o, url);
+  else
+    singleurl(o, url);
+}
+
+void trurl_memo_show(struct option *o)
+{
+  struct memo *m = o->memo;
+  uint64_t lines = m->hits + m->misses;
+  trurl_warnf(o, "--memo: %" CURL_FORMAT_CURL_OFF_TU " hits, %"
+              CURL_FORMAT_CURL_OFF_TU " misses, %.1f%% hit rate, %.1f MB "
+              "used", (curl_off_t)m->hits, (curl_off_t)m->misses,
+              lines ? (double)m->hits * 100 / (double)lines : 0.0,
+              (double)(m->size - m->maxbytes + m->bytes) / 1e6);
+}
+
+void trurl_args(struct option *o, int argc, const char **argv)
+{
+  for(; argc > 0; argc--, argv++) {
+    bool usedarg = false;
+    if(!o->end_of_options && argv[0][0] == '-') {
+      /* dash-dash prefixed */
+      if(getarg(o, argv[0], argc > 1 ? argv[1] : NULL, &usedarg)) {
+        /* if the long option ends with an equals sign, cut it there,
+           if it is a short option, show just two letters */
+        size_t not_e = argv[0][1] == '-' ? strcspn(argv[0], "=") : 2;
+        errorf(o, ERROR_FLAG, "unknown option: %.*s", (int)not_e, argv[0]);
+      }
+    }
+    else if(o->library)
+      errorf(o, ERROR_FLAG, "URLs are passed to trurl_url(): %s", argv[0]);
+    else {
+      /* this is a URL */
+      urladd(o, argv[0]);
+    }
+    if(usedarg) {
+      /* skip the parsed argument */
+      argc--;
+      argv++;
+    }
+  }
+  if(!o->qsep)
+    o->qsep = "&";
+
+  if(o->top && !o->countby)
+    errorf(o, ERROR_FLAG, "--top needs --count-by");
+  if(o->countby) {
+    if(o->jsonout || o->unique)
+      errorf(o, ERROR_FLAG, "--count-by is mutually exclusive with --json "
+             "and --unique");
+    countinit(o);
+  }
+  if(o->compilehosts && (!o->exclude == !o->only))
+    errorf(o, ERROR_FLAG, "--compile-hosts needs one --exclude-hosts or "
+           "--only-hosts");
+  if(o->exclude)
+    hostsload(o, o->exclude);
+  if(o->only)
+    hostsload(o, o->only);
+  if(o->whereip)
+    whereipload(o);
+  if(o->pslfile)
+    pslload(o);
+  if(o->whereexpr)
+    wherecompile(o);
+  if(o->memo && (o->unique || o->countby || o->cardinality))
+    errorf(o, ERROR_FLAG, "--memo is mutually exclusive with --unique, "
+           "--count-by and --cardinality");
+  if(o->cardinality && (o->format || o->jsonout || o->unique))
+    errorf(o, ERROR_FLAG, "--cardinality is mutually exclusive with --get, "
+           "--json, --unique and --count-by");
+
+  /* plain URLs can skip libcurl when only the default output is wanted */
+  o->fastpath = !o->append_path && !o->append_query && !o->set_list &&
+    !o->trim_list && !o->niters && !o->replace_list && !o->redirect &&
+    !o->format && !o->jsonout && !o->curl && !o->default_port &&
+    !o->keep_port && !o->punycode && !o->puny2idn && !o->sort_query &&
+    !o->urlencode && !o->cardinality && !o->where && (o->qsep[0] == '&');
+
+  iterinit(o);
+}
+
+/*
+ * The library API, see trurl.h. Errors inside the engine long jump back to
+ * the API function that was called.
+ */
+
+struct trurl {
+  struct option o;
+};
+
+struct trurl *trurl_new(void)
+{
+  struct trurl *t = calloc(1, sizeof(struct trurl));
+  if(t)
+    t->o.library = true;
+  return t;
+}
+
+TRURLcode trurl_setopt(struct trurl *t, int argc, const char **argv)
+{
+  struct option *o = &t->o;
+  jmp_buf jmp;
+  int rc;
+  int i;
+  size_t size = 0;
+  char *p;
+  o->errmsg[0] = 0;
+  if(o->args) {
+    curl_msnprintf(o->errmsg, sizeof(o->errmsg), "options are already set");
+    return TRURLE_FLAG;
+  }
+  /* the options point into the arguments, so keep a copy of them */
+  for(i = 0; i < argc; i++)
+    size += strlen(argv[i]) + 1;
+  o->args = calloc((size_t)argc + 1, sizeof(char *));
+  o->argbuf = p = malloc(size ? size : 1);
+  if(!o->args || !p)
+    return TRURLE_MEM;
+  for(i = 0; i < argc; i++) {
+    size_t len = strlen(argv[i]) + 1;
+    memcpy(p, argv[i], len);
+    o->args[i] = p;
+    p += len;
+  }
+
+  o->jmp = &jmp;
+  if(!setjmp(jmp)) {
+    trurl_args(o, argc, o->args);
+    rc = TRURLE_OK;
+  }
+  else
+    rc = o->error;
+  o->jmp = NULL;
+  return (TRURLcode)rc;
+}
+
+TRURLcode trurl_url(struct trurl *t, const char *url, char *buf,
+                    size_t size, size_t *len)
+{
+  struct option *o = &t->o;
+  jmp_buf jmp;
+  int rc;
+  if(!o->qsep) {
+    if(o->args) {
+      curl_msnprintf(o->errmsg, sizeof(o->errmsg), "bad options");
+      return TRURLE_FLAG;
+    }
+    /* no trurl_setopt() call */
+    trurl_args(o, 0, NULL);
+  }
+  o->errmsg[0] = 0;
+  o->out.len = 0;
+  o->urls = 0;
+
+  o->jmp = &jmp;
+  if(!setjmp(jmp)) {
+    trurl_json_begin(o);
+    trurl_singleurl(o, url);
+    trurl_json_end(o);
+    rc = TRURLE_OK;
+  }
+  else {
+    /* clean up after the interrupted URL */
+    rc = o->error;
+    urlcleanup(o);
+    freeqpairs(o);
+    o->out.len = 0;
+  }
+  o->jmp = NULL;
+
+  *len = o->out.len;
+  if(!rc) {
+    if(o->out.len >= size) {
+      curl_msnprintf(o->errmsg, sizeof(o->errmsg),
+                     "the output needs %zu bytes", o->out.len + 1);
+      return TRURLE_TOO_SMALL;
+    }
+    if(o->out.len)
+      memcpy(buf, o->out.buf, o->out.len);
+    buf[o->out.len] = 0;
+  }
+  return (TRURLcode)rc;
+}
+
+const char *trurl_errmsg(struct trurl *t)
+{
+  return t->o.errmsg;
+}
+
+void trurl_free(struct trurl *t)
+{
+  if(t) {
+    struct option *o = &t->o;
+    trurl_cleanup_options(o);
+    free(o->args);
+    free(o->argbuf);
+    free(t);
+  }
+}
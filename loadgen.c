@@ -0,0 +1,233 @@
+/***************************************************************************
+ *                             _                   _
+ *  Project                   | |_ _ __ _   _ _ __| |
+ *                            | __| '__| | | | '__| |
+ *                            | |_| |  | |_| | |  | |
+ *                             \__|_|   \__,_|_|  |_|
+ *
+ * Copyright (C) Daniel Stenberg, <daniel@haxx.se>, et al.
+ *
+ * This software is licensed as described in the file COPYING, which
+ * you should have received as part of this distribution. The terms
+ * are also available at https://curl.se/docs/copyright.html.
+ *
+ * You may opt to use, copy, modify, merge, publish, distribute and/or sell
+ * copies of the Software, and permit persons to whom the Software is
+ * furnished to do so, under the terms of the COPYING file.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ * SPDX-License-Identifier: curl
+ *
+ ***************************************************************************/
+
+/*
+ * Load generator for 'trurl --listen'. A number of clients connect to the
+ * socket at the same time and each sends its requests, keeping up to
+ * 'depth' of them in flight. The time from sending a request until its
+ * answer is complete is its latency.
+ *
+ * Usage: loadgen [-c clients] [-n requests] [-d depth] [-o options] socket
+ *
+ * The options are added to every request, tab separated like in the
+ * requests themselves. 'make bench-listen' runs a trurl --listen and this.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <curl/mprintf.h>
+
+#define MAX_LINE 4096
+
+struct loadclient {
+  pthread_t thread;
+  const char *socket;
+  const char *options;
+  long id;
+  long requests;
+  long depth;
+  long *latency;      /* microseconds, one per request */
+  long errors;        /* answered with an error */
+  int failed;         /* the connection failed */
+};
+
+static long usec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int sendrequest(struct loadclient *c, int fd, long n)
+{
+  char line[MAX_LINE];
+  const char *p = line;
+  int len;
+  len = curl_msnprintf(line, sizeof(line),
+                       "%s%shttps://host%ld.example.com/p/%ld?a=%ld&b=%ld\n",
+                       c->options ? c->options : "", c->options ? "\t" : "",
+                       (c->id * 7919 + n) % 1000, n, n, c->id);
+  while(len > 0) {
+    ssize_t w = write(fd, p, (size_t)len);
+    if(w <= 0)
+      return 1;
+    p += w;
+    len -= (int)w;
+  }
+  return 0;
+}
+
+static void *client(void *arg)
+{
+  struct loadclient *c = arg;
+  struct sockaddr_un addr;
+  size_t plen = strlen(c->socket);
+  long *sent = calloc((size_t)c->requests, sizeof(long));
+  long next = 0;
+  long answered = 0;
+  char line[MAX_LINE];
+  FILE *in;
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if(plen >= sizeof(addr.sun_path))
+    plen = sizeof(addr.sun_path) - 1;
+  memcpy(addr.sun_path, c->socket, plen);
+  if(!sent || (fd == -1) ||
+     connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+    fprintf(stderr, "loadgen: %s: %s\n", c->socket, strerror(errno));
+    c->failed = 1;
+    free(sent);
+    return NULL;
+  }
+  in = fdopen(dup(fd), "r");
+
+  while(in && (answered < c->requests)) {
+    long lines;
+    /* keep 'depth' requests in flight */
+    while((next < c->requests) && (next - answered < c->depth)) {
+      sent[next] = usec();
+      if(sendrequest(c, fd, next++))
+        goto fail;
+    }
+    if(!fgets(line, sizeof(line), in))
+      goto fail;
+    if(!strncmp(line, "ok ", 3)) {
+      lines = strtol(&line[3], NULL, 10);
+      while(lines--) {
+        if(!fgets(line, sizeof(line), in))
+          goto fail;
+      }
+    }
+    else if(!strncmp(line, "error ", 6))
+      c->errors++;
+    else
+      goto fail;
+    c->latency[answered] = usec() - sent[answered];
+    answered++;
+  }
+  if(in) {
+    fclose(in);
+    close(fd);
+    free(sent);
+    return NULL;
+  }
+fail:
+  fprintf(stderr, "loadgen: client %ld failed after %ld answers\n",
+          c->id, answered);
+  c->failed = 1;
+  if(in)
+    fclose(in);
+  close(fd);
+  free(sent);
+  return NULL;
+}
+
+static int cmplong(const void *a, const void *b)
+{
+  long x = *(const long *)a;
+  long y = *(const long *)b;
+  return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv)
+{
+  long clients = 4;
+  long requests = 10000;
+  long depth = 1;
+  const char *options = NULL;
+  struct loadclient *c;
+  long *all;
+  long total;
+  long errors = 0;
+  long start;
+  long took;
+  int failed = 0;
+  int i;
+  long n;
+
+  for(i = 1; i < argc - 1; i += 2) {
+    if(!strcmp(argv[i], "-c"))
+      clients = strtol(argv[i + 1], NULL, 10);
+    else if(!strcmp(argv[i], "-n"))
+      requests = strtol(argv[i + 1], NULL, 10);
+    else if(!strcmp(argv[i], "-d"))
+      depth = strtol(argv[i + 1], NULL, 10);
+    else if(!strcmp(argv[i], "-o"))
+      options = argv[i + 1];
+    else
+      break;
+  }
+  if((i != argc - 1) || (clients < 1) || (requests < 1) || (depth < 1)) {
+    fprintf(stderr, "Usage: loadgen [-c clients] [-n requests] [-d depth] "
+            "[-o options] socket\n");
+    return 1;
+  }
+
+  total = clients * requests;
+  c = calloc((size_t)clients, sizeof(struct loadclient));
+  all = calloc((size_t)total, sizeof(long));
+  if(!c || !all)
+    return 1;
+
+  start = usec();
+  for(n = 0; n < clients; n++) {
+    c[n].socket = argv[argc - 1];
+    c[n].options = options;
+    c[n].id = n;
+    c[n].requests = requests;
+    c[n].depth = depth;
+    c[n].latency = &all[n * requests];
+    if(pthread_create(&c[n].thread, NULL, client, &c[n]))
+      return 1;
+  }
+  for(n = 0; n < clients; n++) {
+    pthread_join(c[n].thread, NULL);
+    errors += c[n].errors;
+    failed |= c[n].failed;
+  }
+  took = usec() - start;
+  if(failed)
+    return 1;
+
+  qsort(all, (size_t)total, sizeof(long), cmplong);
+  printf("%ld clients, %ld requests each, depth %ld\n",
+         clients, requests, depth);
+  printf("%.0f requests/s, %ld error answers\n",
+         (double)total * 1000000 / (double)(took ? took : 1), errors);
+  printf("latency us: p50 %ld, p90 %ld, p99 %ld, max %ld\n",
+         all[total / 2], all[total * 9 / 10], all[total * 99 / 100],
+         all[total - 1]);
+  free(all);
+  free(c);
+  return 0;
+}
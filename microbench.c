@@ -0,0 +1,261 @@
+/***************************************************************************
+ *                             _                   _
+ *  Project                   | |_ _ __ _   _ _ __| |
+ *                            | __| '__| | | | '__| |
+ *                            | |_| |  | |_| | |  | |
+ *                             \__|_|   \__,_|_|  |_|
+ *
+ * Copyright (C) Daniel Stenberg, <daniel@haxx.se>, et al.
+ *
+ * This software is licensed as described in the file COPYING, which
+ * you should have received as part of this distribution. The terms
+ * are also available at https://curl.se/docs/copyright.html.
+ *
+ * You may opt to use, copy, modify, merge, publish, distribute and/or sell
+ * copies of the Software, and permit persons to whom the Software is
+ * furnished to do so, under the terms of the COPYING file.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ * SPDX-License-Identifier: curl
+ *
+ ***************************************************************************/
+
+/*
+ * Microbenchmark for the string functions in libtrurl.c. It is built
+ * together with libtrurl.c and TRURL_MICROBENCH defined, which makes the
+ * functions marked UNITTEST visible. Each function is called over and over
+ * on inputs like the ones found in real URLs, until at least 'ms'
+ * milliseconds have passed, and the time per input byte is shown. On x86
+ * also the time stamp counter cycles per byte.
+ *
+ * Usage: microbench [ms]
+ */
+
+#include "trurl_int.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <curl/mprintf.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define HAVE_RDTSC
+#endif
+
+/* query pairs as found in real URLs, encoded */
+static const char *const pairs[] = {
+  "utm_source=newsletter",
+  "utm_medium=email",
+  "utm_campaign=spring_sale_2024",
+  "q=caf%C3%A9+au+lait",
+  "page=2",
+  "sort=price%2Casc",
+  "lang=en-US",
+  "redirect=https%3A%2F%2Fexample.com%2Fa%2Fb%3Fc%3Dd",
+  "name=J%C3%BCrgen+M%C3%BCller",
+  "empty",
+};
+#define NPAIRS (sizeof(pairs) / sizeof(pairs[0]))
+
+/* decoded query parts, for the encoder */
+static const char *const plain[] = {
+  "newsletter",
+  "café au lait",
+  "https://example.com/a/b?c=d",
+  "Jürgen Müller",
+  "price,asc",
+  "spring_sale_2024",
+};
+#define NPLAIN (sizeof(plain) / sizeof(plain[0]))
+
+static const char *const paths[] = {
+  "/",
+  "/index.html",
+  "/images/2024/05/photo%20one.jpg",
+  "/api/v2/users/12345/orders",
+  "/wiki/%E6%97%A5%E6%9C%AC%E8%AA%9E/%7Euser/a%2Fb",
+  "/a/b/c/d/e/f/g/h/i/j/k/l/m/n/o/p",
+};
+#define NPATHS (sizeof(paths) / sizeof(paths[0]))
+
+/* strings put into --json output */
+static const char *const jsons[] = {
+  "https://example.com/search?q=caf%C3%A9",
+  "example.com",
+  "say \"hi\"\tand\\or\nleave",
+  "r\xc3\xa4ksm\xc3\xb6rg\xc3\xa5s",
+  "/a/very/long/path/with/many/segments/in/it/index.html",
+};
+#define NJSONS (sizeof(jsons) / sizeof(jsons[0]))
+
+static char work[4096]; /* a writable copy of the input */
+
+/* each kernel runs once over its inputs and returns the bytes it did */
+static size_t k_decodequery(struct option *o)
+{
+  size_t bytes = 0;
+  size_t i;
+  for(i = 0; i < NPAIRS; i++) {
+    size_t len = strlen(pairs[i]);
+    size_t olen;
+    /* it replaces '+' in place */
+    memcpy(work, pairs[i], len + 1);
+    if(!decodequery(o, work, len, &olen))
+      exit(1);
+    bytes += len;
+  }
+  return bytes;
+}
+
+static size_t k_encodequery(struct option *o)
+{
+  size_t bytes = 0;
+  size_t i;
+  for(i = 0; i < NPLAIN; i++) {
+    size_t len = strlen(plain[i]);
+    memcpy(work, plain[i], len + 1);
+    if(!encodequery(o, work, len))
+      exit(1);
+    bytes += len;
+  }
+  return bytes;
+}
+
+static size_t k_memdupzero(struct option *o)
+{
+  size_t bytes = 0;
+  size_t i;
+  for(i = 0; i < NPAIRS; i++) {
+    size_t len = strlen(pairs[i]);
+    bool modified = false;
+    memcpy(work, pairs[i], len + 1);
+    if(!memdupzero(o, work, len, &modified))
+      exit(1);
+    bytes += len;
+  }
+  return bytes;
+}
+
+static size_t k_canonical_path(struct option *o)
+{
+  size_t bytes = 0;
+  size_t i;
+  (void)o;
+  for(i = 0; i < NPATHS; i++) {
+    char *c = canonical_path(paths[i]);
+    if(!c)
+      exit(1);
+    curl_free(c);
+    bytes += strlen(paths[i]);
+  }
+  return bytes;
+}
+
+static size_t k_jsonString(struct option *o)
+{
+  size_t bytes = 0;
+  size_t i;
+  for(i = 0; i < NJSONS; i++) {
+    size_t len = strlen(jsons[i]);
+    jsonString(o, jsons[i], len, false);
+    bytes += len;
+  }
+  o->out.len = 0;
+  return bytes;
+}
+
+static struct string keys[NPAIRS];
+
+static size_t k_cmpfunc(struct option *o)
+{
+  size_t bytes = 0;
+  size_t i;
+  size_t j;
+  volatile int sink = 0;
+  (void)o;
+  /* every pair against every other, like the sorting does */
+  for(i = 0; i < NPAIRS; i++) {
+    for(j = 0; j < NPAIRS; j++) {
+      sink += cmpfunc(&keys[i], &keys[j]);
+      bytes += keys[i].len < keys[j].len ? keys[i].len : keys[j].len;
+    }
+  }
+  return bytes;
+}
+
+struct kernel {
+  const char *name;
+  size_t (*run)(struct option *o);
+};
+
+static const struct kernel kernels[] = {
+  { "decodequery", k_decodequery },
+  { "encodequery", k_encodequery },
+  { "memdupzero", k_memdupzero },
+  { "canonical_path", k_canonical_path },
+  { "jsonString", k_jsonString },
+  { "cmpfunc", k_cmpfunc },
+};
+
+int main(int argc, char **argv)
+{
+  struct option o;
+  uint64_t ms = 200;
+  size_t i;
+  memset(&o, 0, sizeof(o));
+  if(argc > 1)
+    ms = (uint64_t)strtoul(argv[1], NULL, 10);
+  for(i = 0; i < NPAIRS; i++) {
+    keys[i].str = strdup(pairs[i]);
+    if(!keys[i].str)
+      return 1;
+    keys[i].len = strlen(pairs[i]);
+  }
+
+  curl_mprintf("%-16s %12s %10s %10s %12s\n", "function", "runs/s", "MB/s",
+               "ns/byte", "cycles/byte");
+  for(i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+    const struct kernel *k = &kernels[i];
+    uint64_t calls = 0;
+    uint64_t bytes = 0;
+    uint64_t start;
+    uint64_t took;
+#ifdef HAVE_RDTSC
+    uint64_t cycles;
+#endif
+    /* warm up caches and the arena */
+    k->run(&o);
+    arenareset(&o);
+#ifdef HAVE_RDTSC
+    cycles = __rdtsc();
+#endif
+    start = trurl_nanotime();
+    do {
+      unsigned int n;
+      for(n = 0; n < 1000; n++) {
+        bytes += k->run(&o);
+        arenareset(&o);
+      }
+      calls += 1000;
+      took = trurl_nanotime() - start;
+    } while(took < ms * 1000000);
+#ifdef HAVE_RDTSC
+    cycles = __rdtsc() - cycles;
+#endif
+    curl_mprintf("%-16s %12.0f %10.1f %10.3f ", k->name,
+                 (double)calls * 1e9 / (double)took,
+                 (double)bytes * 1e3 / (double)took,
+                 (double)took / (double)bytes);
+#ifdef HAVE_RDTSC
+    curl_mprintf("%12.3f\n", (double)cycles / (double)bytes);
+#else
+    curl_mprintf("%12s\n", "-");
+#endif
+  }
+  for(i = 0; i < NPAIRS; i++)
+    free(keys[i].str);
+  trurl_cleanup_options(&o);
+  return 0;
+}
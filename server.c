@@ -0,0 +1,758 @@
+/***************************************************************************
+ *                             _                   _
+ *  Project                   | |_ _ __ _   _ _ __| |
+ *                            | __| '__| | | | '__| |
+ *                            | |_| |  | |_| | |  | |
+ *                             \__|_|   \__,_|_|  |_|
+ *
+ * Copyright (C) Daniel Stenberg, <daniel@haxx.se>, et al.
+ *
+ * This software is licensed as described in the file COPYING, which
+ * you should have received as part of this distribution. The terms
+ * are also available at https://curl.se/docs/copyright.html.
+ *
+ * You may opt to use, copy, modify, merge, publish, distribute and/or sell
+ * copies of the Software, and permit persons to whom the Software is
+ * furnished to do so, under the terms of the COPYING file.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ * SPDX-License-Identifier: curl
+ *
+ ***************************************************************************/
+
+/*
+ * --server and --listen: trurl keeps running and answers requests, using
+ * the library API. --server reads them from stdin, --listen from clients
+ * connecting to a Unix domain socket.
+ *
+ * A request is a line with options and a URL, separated by tabs, the URL
+ * last. The answer is a line with "ok [lines]" followed by that many lines
+ * of output, or a single "error [code] [message]" line.
+ */
+
+#include "trurl_int.h" /* first, it has the platform setup */
+#include "trurl.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <curl/mprintf.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#define HAVE_LISTEN
+#endif
+
+#ifdef _MSC_VER
+#define strdup _strdup
+#endif
+
+#define SERVER_CONTEXTS 64  /* option sets kept parsed, per worker */
+#define SERVER_LINE 4096    /* initial request line buffer */
+#define LISTEN_BATCH 65536  /* request bytes handed to a worker at once */
+#define LISTEN_READ 16384   /* bytes read from a client at once */
+#define LISTEN_UNSENT (1024 * 1024) /* answer bytes waiting for a client */
+#define LISTEN_LINE (1024 * 1024) /* longest request line */
+
+/* an option set parsed for requests, kept in most recently used order */
+struct context {
+  struct context *next;
+  struct trurl *t;
+  char *key; /* the options part of the request line */
+};
+
+/* what answering requests needs, one per thread */
+struct worker {
+  struct option *o;
+  struct context *cache;
+  int ncontexts;
+  int nbase;
+  const char **base; /* the command line options, for all requests */
+  char *out;         /* trurl_url() output */
+  size_t outsize;
+#ifdef HAVE_LISTEN
+  struct listener *l;
+  pthread_t thread;
+#endif
+};
+
+static void addn(struct option *o, struct outbuf *b, const char *data,
+                 size_t len)
+{
+  if(b->len + len > b->size) {
+    size_t nsize = b->size ? b->size : SERVER_LINE;
+    char *n;
+    while(nsize < b->len + len)
+      nsize *= 2;
+    n = realloc(b->buf, nsize);
+    if(!n)
+      trurl_errorf(o, ERROR_MEM, "out of memory");
+    b->buf = n;
+    b->size = nsize;
+  }
+  memcpy(&b->buf[b->len], data, len);
+  b->len += len;
+}
+
+/* parse the options of a request on top of the command line ones */
+static struct context *newcontext(struct worker *w, const char *key,
+                                  TRURLcode *rc)
+{
+  struct context *c = calloc(1, sizeof(struct context));
+  const char **args = NULL;
+  char *fields = NULL;
+  int nargs = w->nbase;
+  const char *p;
+  if(c) {
+    c->key = strdup(key);
+    fields = strdup(key);
+    c->t = trurl_new();
+    if(*key) {
+      nargs++;
+      for(p = strchr(key, '\t'); p; p = strchr(p + 1, '\t'))
+        nargs++;
+    }
+    args = malloc((size_t)(nargs + 1) * sizeof(char *));
+  }
+  if(!c || !c->key || !fields || !c->t || !args)
+    trurl_errorf(w->o, ERROR_MEM, "out of memory");
+
+  memcpy(args, w->base, (size_t)w->nbase * sizeof(char *));
+  nargs = w->nbase;
+  if(*fields) {
+    char *f = fields;
+    do {
+      char *tab = strchr(f, '\t');
+      args[nargs++] = f;
+      if(tab)
+        *tab++ = 0;
+      f = tab;
+    } while(f);
+  }
+  *rc = trurl_setopt(c->t, nargs, args);
+  free(args);
+  free(fields);
+  return c;
+}
+
+static void freecontext(struct context *c)
+{
+  trurl_free(c->t);
+  free(c->key);
+  free(c);
+}
+
+/* answer the request in 'line', the answer is added to 'answer' */
+static void request(struct worker *w, char *line, struct outbuf *answer)
+{
+  struct context *c;
+  struct context **prev = &w->cache;
+  char *url = strrchr(line, '\t');
+  const char *key = "";
+  const char *input;
+  TRURLcode rc = TRURLE_OK;
+  char status[300];
+  size_t len;
+  if(url) {
+    *url++ = 0;
+    key = line;
+  }
+  else
+    url = line;
+  input = *url ? url : NULL; /* no URL works like no URL argument */
+
+  /* find the parsed options and move them first */
+  for(c = w->cache; c; prev = &c->next, c = c->next) {
+    if(!strcmp(c->key, key)) {
+      *prev = c->next;
+      break;
+    }
+  }
+  if(!c) {
+    c = newcontext(w, key, &rc);
+    if(rc) {
+      curl_msnprintf(status, sizeof(status), "error %d %s\n", (int)rc,
+                     trurl_errmsg(c->t));
+      addn(w->o, answer, status, strlen(status));
+      freecontext(c);
+      return;
+    }
+    if(++w->ncontexts > SERVER_CONTEXTS) {
+      /* forget the least recently used */
+      struct context **last = &w->cache;
+      while((*last)->next)
+        last = &(*last)->next;
+      freecontext(*last);
+      *last = NULL;
+      w->ncontexts--;
+    }
+  }
+  c->next = w->cache;
+  w->cache = c;
+
+  rc = trurl_url(c->t, input, w->out, w->outsize, &len);
+  if(rc == TRURLE_TOO_SMALL) {
+    char *n = realloc(w->out, len + 1);
+    if(!n)
+      trurl_errorf(w->o, ERROR_MEM, "out of memory");
+    w->out = n;
+    w->outsize = len + 1;
+    rc = trurl_url(c->t, input, w->out, w->outsize, &len);
+  }
+  if(rc)
+    curl_msnprintf(status, sizeof(status), "error %d %s\n", (int)rc,
+                   trurl_errmsg(c->t));
+  else {
+    unsigned long lines = 0;
+    size_t i;
+    for(i = 0; i < len; i++)
+      if(w->out[i] == '\n')
+        lines++;
+    curl_msnprintf(status, sizeof(status), "ok %lu\n", lines);
+  }
+  addn(w->o, answer, status, strlen(status));
+  if(!rc)
+    addn(w->o, answer, w->out, len);
+}
+
+/* the command line options without the ones for the server itself */
+static void initworker(struct worker *w, struct option *o,
+                       int argc, const char **argv)
+{
+  int i;
+  memset(w, 0, sizeof(*w));
+  w->o = o;
+  w->outsize = OUTBUF_SIZE;
+  w->out = malloc(w->outsize);
+  w->base = malloc((size_t)(argc + 1) * sizeof(char *));
+  if(!w->out || !w->base)
+    trurl_errorf(o, ERROR_MEM, "out of memory");
+  for(i = 0; i < argc; i++) {
+    if(!strcmp(argv[i], "--listen") || !strcmp(argv[i], "--workers"))
+      i++; /* and its argument */
+    else if(strcmp(argv[i], "--server") &&
+            strncmp(argv[i], "--listen=", 9) &&
+            strncmp(argv[i], "--workers=", 10))
+      w->base[w->nbase++] = argv[i];
+  }
+}
+
+static void cleanupworker(struct worker *w)
+{
+  while(w->cache) {
+    struct context *next = w->cache->next;
+    freecontext(w->cache);
+    w->cache = next;
+  }
+  free(w->base);
+  free(w->out);
+}
+
+/* read a line of any length without the newline, false at end of file */
+static bool readline(struct option *o, FILE *f, struct outbuf *line)
+{
+  line->len = 0;
+  for(;;) {
+    if(line->len + 1 >= line->size) {
+      size_t nsize = line->size ? line->size * 2 : SERVER_LINE;
+      char *n = realloc(line->buf, nsize);
+      if(!n)
+        trurl_errorf(o, ERROR_MEM, "out of memory");
+      line->buf = n;
+      line->size = nsize;
+    }
+    if(!fgets(&line->buf[line->len], (int)(line->size - line->len), f)) {
+      if(ferror(f))
+        trurl_errorf(o, ERROR_FILE, "fgets: %s", strerror(errno));
+      if(!line->len)
+        return false;
+      break;
+    }
+    line->len += strlen(&line->buf[line->len]);
+    if(line->len && (line->buf[line->len - 1] == '\n'))
+      break;
+  }
+  while(line->len && ((line->buf[line->len - 1] == '\n') ||
+                      (line->buf[line->len - 1] == '\r')))
+    line->len--;
+  line->buf[line->len] = 0;
+  return true;
+}
+
+/* --server: answer requests from stdin until end of file */
+void trurl_server(struct option *o, int argc, const char **argv)
+{
+  struct worker w;
+  struct outbuf line;
+  struct outbuf answer;
+  memset(&line, 0, sizeof(line));
+  memset(&answer, 0, sizeof(answer));
+  initworker(&w, o, argc, argv);
+
+  while(readline(o, stdin, &line)) {
+    answer.len = 0;
+    request(&w, line.buf, &answer);
+    fwrite(answer.buf, 1, answer.len, stdout);
+    fflush(stdout);
+  }
+  cleanupworker(&w);
+  free(line.buf);
+  free(answer.buf);
+}
+
+#ifdef HAVE_LISTEN
+
+/*
+ * --listen: an event loop reads requests from any number of clients and
+ * hands complete lines over to the worker threads in batches. A client has
+ * at most one batch with the workers, which keeps its answers in order.
+ * When a batch is done, the worker wakes up the event loop with a byte on
+ * a pipe and the loop sends the answers.
+ */
+
+struct client;
+
+struct batch {
+  struct batch *next;
+  struct client *client;
+  struct outbuf in;  /* complete request lines */
+  struct outbuf out; /* the answers */
+};
+
+struct client {
+  int fd;
+  struct outbuf in;  /* received, not yet handed to a worker */
+  struct outbuf out; /* answers to send */
+  size_t sent;       /* how much of 'out' */
+  size_t scanned;    /* of a line longer than a batch, 0 for none */
+  bool toolong;      /* dropping the rest of a line over LISTEN_LINE */
+  bool busy;         /* a batch is with the workers */
+  bool eof;          /* the client sends no more */
+  bool gone;         /* the connection failed */
+};
+
+struct listener {
+  struct option *o;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  struct batch *todo;       /* for the workers, first in first out */
+  struct batch **todotail;
+  struct batch *done;       /* back from the workers */
+  int wake[2];              /* pipe the workers wake the event loop with */
+  bool quit;
+};
+
+static volatile sig_atomic_t stop;
+static int stopfd = -1;
+
+static void stopsignal(int sig)
+{
+  (void)sig;
+  stop = 1;
+  if(stopfd != -1) {
+    ssize_t rc = write(stopfd, "", 1);
+    (void)rc;
+  }
+}
+
+static void *workerthread(void *arg)
+{
+  struct worker *w = arg;
+  struct listener *l = w->l;
+  pthread_mutex_lock(&l->lock);
+  for(;;) {
+    struct batch *b;
+    char *line;
+    char *end;
+    ssize_t rc;
+    while(!l->todo && !l->quit)
+      pthread_cond_wait(&l->cond, &l->lock);
+    if(l->quit)
+      break;
+    b = l->todo;
+    l->todo = b->next;
+    if(!l->todo)
+      l->todotail = &l->todo;
+    pthread_mutex_unlock(&l->lock);
+
+    /* every line ends with a newline */
+    end = &b->in.buf[b->in.len];
+    for(line = b->in.buf; line < end;) {
+      char *nl = memchr(line, '\n', (size_t)(end - line));
+      char *next = nl + 1;
+      if((nl > line) && (nl[-1] == '\r'))
+        nl--;
+      *nl = 0;
+      request(w, line, &b->out);
+      line = next;
+    }
+
+    pthread_mutex_lock(&l->lock);
+    b->next = l->done;
+    l->done = b;
+    rc = write(l->wake[1], "", 1);
+    (void)rc; /* a full pipe wakes it up anyway */
+  }
+  pthread_mutex_unlock(&l->lock);
+  return NULL;
+}
+
+/* hand over the complete lines the client has sent to the workers */
+static void startbatch(struct listener *l, struct client *c)
+{
+  struct batch *b;
+  size_t n = c->in.len;
+  if(c->busy || c->gone || !n)
+    return;
+  if(c->out.len - c->sent > LISTEN_UNSENT)
+    /* wait for the client to read its answers */
+    return;
+  if(c->toolong) {
+    char *nl = memchr(c->in.buf, '\n', n);
+    if(!nl) {
+      c->in.len = 0;
+      return;
+    }
+    n = (size_t)(nl - c->in.buf) + 1;
+    memmove(c->in.buf, &c->in.buf[n], c->in.len - n);
+    c->in.len -= n;
+    c->toolong = false;
+    n = c->in.len;
+    if(!n)
+      return;
+  }
+  if(c->eof && (c->in.buf[n - 1] != '\n'))
+    /* the last line lacks a newline */
+    addn(l->o, &c->in, "\n", 1);
+  n = c->in.len;
+  if(n > LISTEN_BATCH)
+    n = LISTEN_BATCH;
+  while(n && (c->in.buf[n - 1] != '\n'))
+    n--;
+  if(!n) {
+    /* a line longer than a batch */
+    char *nl = memchr(&c->in.buf[c->scanned], '\n',
+                      c->in.len - c->scanned);
+    if(!nl) {
+      if(c->in.len > LISTEN_LINE) {
+        /* answer it now and drop it, instead of buffering it all */
+        char status[80];
+        curl_msnprintf(status, sizeof(status),
+                       "error %d request line longer than %d bytes\n",
+                       (int)TRURLE_BADURL, LISTEN_LINE);
+        addn(l->o, &c->out, status, strlen(status));
+        c->in.len = c->scanned = 0;
+        c->toolong = true;
+        return;
+      }
+      /* keep reading until it ends, without looking at this part again */
+      c->scanned = c->in.len;
+      return;
+    }
+    c->scanned = 0;
+    n = (size_t)(nl - c->in.buf) + 1;
+  }
+
+  b = calloc(1, sizeof(struct batch));
+  if(!b)
+    trurl_errorf(l->o, ERROR_MEM, "out of memory");
+  b->client = c;
+  addn(l->o, &b->in, c->in.buf, n);
+  memmove(c->in.buf, &c->in.buf[n], c->in.len - n);
+  c->in.len -= n;
+  c->busy = true;
+
+  pthread_mutex_lock(&l->lock);
+  *l->todotail = b;
+  l->todotail = &b->next;
+  pthread_cond_signal(&l->cond);
+  pthread_mutex_unlock(&l->lock);
+}
+
+/* the answers of finished batches go to their clients */
+static void finishbatches(struct listener *l)
+{
+  struct batch *b;
+  char drain[64];
+  while(read(l->wake[0], drain, sizeof(drain)) > 0)
+    ;
+  pthread_mutex_lock(&l->lock);
+  b = l->done;
+  l->done = NULL;
+  pthread_mutex_unlock(&l->lock);
+  while(b) {
+    struct batch *next = b->next;
+    struct client *c = b->client;
+    if(!c->gone) {
+      if(c->sent) {
+        /* drop what is already sent */
+        memmove(c->out.buf, &c->out.buf[c->sent], c->out.len - c->sent);
+        c->out.len -= c->sent;
+        c->sent = 0;
+      }
+      addn(l->o, &c->out, b->out.buf, b->out.len);
+    }
+    c->busy = false;
+    free(b->in.buf);
+    free(b->out.buf);
+    free(b);
+    b = next;
+  }
+}
+
+static void readclient(struct client *c, struct option *o)
+{
+  ssize_t n;
+  if(c->in.size - c->in.len < LISTEN_READ) {
+    size_t nsize = c->in.size ? c->in.size : LISTEN_READ;
+    char *p;
+    while(nsize - c->in.len < LISTEN_READ)
+      nsize *= 2;
+    p = realloc(c->in.buf, nsize);
+    if(!p)
+      trurl_errorf(o, ERROR_MEM, "out of memory");
+    c->in.buf = p;
+    c->in.size = nsize;
+  }
+  n = read(c->fd, &c->in.buf[c->in.len], c->in.size - c->in.len);
+  if(n > 0)
+    c->in.len += (size_t)n;
+  else if(!n)
+    c->eof = true;
+  else if((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+    c->gone = true;
+}
+
+static void writeclient(struct client *c)
+{
+  ssize_t n = write(c->fd, &c->out.buf[c->sent], c->out.len - c->sent);
+  if(n > 0) {
+    c->sent += (size_t)n;
+    if(c->sent == c->out.len)
+      c->out.len = c->sent = 0;
+  }
+  else if((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+    c->gone = true;
+}
+
+static void nonblock(struct option *o, int fd)
+{
+  int flags = fcntl(fd, F_GETFL, 0);
+  if((flags == -1) || (fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1))
+    trurl_errorf(o, ERROR_FILE, "fcntl: %s", strerror(errno));
+}
+
+static int listensocket(struct option *o)
+{
+  struct sockaddr_un addr;
+  struct stat st;
+  int fd;
+  if(strlen(o->listen) >= sizeof(addr.sun_path))
+    trurl_errorf(o, ERROR_FLAG, "--listen socket name too long");
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, o->listen);
+  /* replace a socket left behind, never anything else */
+  if(!stat(o->listen, &st) && S_ISSOCK(st.st_mode))
+    unlink(o->listen);
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(fd == -1)
+    trurl_errorf(o, ERROR_FILE, "socket: %s", strerror(errno));
+  if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+     listen(fd, SOMAXCONN))
+    trurl_errorf(o, ERROR_FILE, "--listen %s: %s", o->listen, strerror(errno));
+  nonblock(o, fd);
+  return fd;
+}
+
+/* --listen: answer requests from socket clients until SIGINT or SIGTERM */
+void trurl_listen(struct option *o, int argc, const char **argv)
+{
+  struct listener l;
+  struct worker *workers;
+  struct client **clients = NULL;
+  struct pollfd *fds = NULL;
+  size_t nclients = 0;
+  size_t nalloc = 0;
+  unsigned int nworkers = o->workers;
+  unsigned int i;
+  size_t c;
+  int fd = listensocket(o);
+
+  if(!nworkers) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    nworkers = (cpus > 0) ? (unsigned int)cpus : 1;
+    if(nworkers > MAX_WORKERS)
+      nworkers = MAX_WORKERS;
+  }
+
+  memset(&l, 0, sizeof(l));
+  l.o = o;
+  l.todotail = &l.todo;
+  pthread_mutex_init(&l.lock, NULL);
+  pthread_cond_init(&l.cond, NULL);
+  if(pipe(l.wake))
+    trurl_errorf(o, ERROR_FILE, "pipe: %s", strerror(errno));
+  nonblock(o, l.wake[0]);
+  nonblock(o, l.wake[1]);
+
+  stopfd = l.wake[1];
+  signal(SIGINT, stopsignal);
+  signal(SIGTERM, stopsignal);
+  signal(SIGPIPE, SIG_IGN);
+
+  workers = calloc(nworkers, sizeof(struct worker));
+  if(!workers)
+    trurl_errorf(o, ERROR_MEM, "out of memory");
+  for(i = 0; i < nworkers; i++) {
+    initworker(&workers[i], o, argc, argv);
+    workers[i].l = &l;
+    if(pthread_create(&workers[i].thread, NULL, workerthread, &workers[i]))
+      trurl_errorf(o, ERROR_MEM, "cannot create worker thread");
+  }
+
+  while(!stop) {
+    size_t nfds = 2;
+    if(nalloc < nclients + 2) {
+      struct pollfd *n;
+      nalloc = (nclients + 2) * 2;
+      n = realloc(fds, nalloc * sizeof(struct pollfd));
+      if(!n)
+        trurl_errorf(o, ERROR_MEM, "out of memory");
+      fds = n;
+    }
+    fds[0].fd = fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = l.wake[0];
+    fds[1].events = POLLIN;
+    for(c = 0; c < nclients; c++) {
+      struct client *cl = clients[c];
+      struct pollfd *p = &fds[nfds++];
+      p->fd = cl->gone ? -1 : cl->fd;
+      p->events = 0;
+      /* stop reading from a client that sends faster than it is served,
+         unless it is in the middle of a line longer than a batch, and from
+         one that does not read its answers */
+      if(!cl->eof && ((cl->in.len < LISTEN_BATCH) || cl->scanned) &&
+         (cl->out.len - cl->sent <= LISTEN_UNSENT))
+        p->events |= POLLIN;
+      if(cl->sent < cl->out.len)
+        p->events |= POLLOUT;
+    }
+    for(i = 0; i < nfds; i++)
+      fds[i].revents = 0;
+
+    if(poll(fds, (nfds_t)nfds, -1) < 0) {
+      if(errno == EINTR)
+        continue;
+      trurl_errorf(o, ERROR_FILE, "poll: %s", strerror(errno));
+    }
+
+    if(fds[1].revents)
+      finishbatches(&l);
+
+    for(c = 0; c < nclients; c++) {
+      struct client *cl = clients[c];
+      short re = fds[c + 2].revents;
+      if(re & POLLIN)
+        readclient(cl, o);
+      else if(re & (POLLHUP | POLLERR))
+        cl->gone = true;
+      if(!cl->gone && (re & POLLOUT))
+        writeclient(cl);
+    }
+
+    /* start new batches and say goodbye to clients that are done */
+    for(c = 0; c < nclients;) {
+      struct client *cl = clients[c];
+      startbatch(&l, cl);
+      if(!cl->busy &&
+         (cl->gone || (cl->eof && !cl->in.len && !cl->out.len))) {
+        close(cl->fd);
+        free(cl->in.buf);
+        free(cl->out.buf);
+        free(cl);
+        clients[c] = clients[--nclients];
+      }
+      else
+        c++;
+    }
+
+    if(fds[0].revents & POLLIN) {
+      for(;;) {
+        struct client *cl;
+        int cfd = accept(fd, NULL, NULL);
+        if(cfd == -1)
+          break;
+        nonblock(o, cfd);
+        cl = calloc(1, sizeof(struct client));
+        if(!(nclients % 64)) {
+          struct client **n = realloc(clients, (nclients + 64) *
+                                      sizeof(struct client *));
+          if(!n)
+            trurl_errorf(o, ERROR_MEM, "out of memory");
+          clients = n;
+        }
+        if(!cl)
+          trurl_errorf(o, ERROR_MEM, "out of memory");
+        cl->fd = cfd;
+        clients[nclients++] = cl;
+      }
+    }
+  }
+
+  pthread_mutex_lock(&l.lock);
+  l.quit = true;
+  pthread_cond_broadcast(&l.cond);
+  pthread_mutex_unlock(&l.lock);
+  for(i = 0; i < nworkers; i++) {
+    pthread_join(workers[i].thread, NULL);
+    cleanupworker(&workers[i]);
+  }
+  free(workers);
+
+  /* batches that never made it through */
+  while(l.todo) {
+    struct batch *next = l.todo->next;
+    free(l.todo->in.buf);
+    free(l.todo->out.buf);
+    free(l.todo);
+    l.todo = next;
+  }
+  finishbatches(&l);
+  for(c = 0; c < nclients; c++) {
+    close(clients[c]->fd);
+    free(clients[c]->in.buf);
+    free(clients[c]->out.buf);
+    free(clients[c]);
+  }
+  free(clients);
+  free(fds);
+  stopfd = -1;
+  close(l.wake[0]);
+  close(l.wake[1]);
+  close(fd);
+  unlink(o->listen);
+  pthread_mutex_destroy(&l.lock);
+  pthread_cond_destroy(&l.cond);
+}
+
+#else
+
+void trurl_listen(struct option *o, int argc, const char **argv)
+{
+  (void)argc;
+  (void)argv;
+  trurl_errorf(o, ERROR_FLAG, "--listen is not supported on this platform");
+}
+
+#endif
@@ -0,0 +1,89 @@
+#!/usr/bin/env python3
+##########################################################################
+#                                  _   _ ____  _
+#  Project                     ___| | | |  _ \| |
+#                             / __| | | | |_) | |
+#                            | (__| |_| |  _ <| |___
+#                             \___|\___/|_| \_\_____|
+#
+# Copyright (C) Daniel Stenberg, <daniel@haxx.se>, et al.
+#
+# This software is licensed as described in the file COPYING, which
+# you should have received as part of this distribution. The terms
+# are also available at https://curl.se/docs/copyright.html.
+#
+# You may opt to use, copy, modify, merge, publish, distribute and/or sell
+# copies of the Software, and permit persons to whom the Software is
+# furnished to do so, under the terms of the COPYING file.
+#
+# This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+# KIND, either express or implied.
+#
+# SPDX-License-Identifier: curl
+#
+##########################################################################
+
+# Startup benchmark: run trurl with a single URL many times and show how
+# long a run takes, from start until it has exited. That is what a shell
+# pipeline calling trurl once per URL pays. A run of /bin/true shows what
+# starting any process costs on this system.
+
+import os
+import sys
+import time
+
+PROGNAME = "trurl"
+URL = "https://example.com/path?a=b"
+
+
+def measure(cmd, runs):
+    devnull = os.open(os.devnull, os.O_WRONLY)
+    times = []
+    try:
+        for _ in range(runs):
+            start = time.perf_counter()
+            pid = os.posix_spawn(cmd[0], cmd, os.environ,
+                                 file_actions=[(os.POSIX_SPAWN_DUP2,
+                                                devnull, 1)])
+            _, status = os.waitpid(pid, 0)
+            times.append(time.perf_counter() - start)
+            if status:
+                print(f"{cmd[0]} failed", file=sys.stderr)
+                return None
+    finally:
+        os.close(devnull)
+    times.sort()
+    return [times[len(times) * p // 100] * 1000000 for p in (10, 50, 90)]
+
+
+def main(argv):
+    trurl = os.path.join(os.getcwd(), PROGNAME)
+    runs = 1000
+    others = []
+
+    for arg in argv[1:]:
+        if arg.startswith("--trurl="):
+            trurl = arg[len("--trurl="):]
+        elif arg.startswith("--reference="):
+            others.append(arg[len("--reference="):])
+        elif arg.startswith("--runs="):
+            runs = int(arg[len("--runs="):])
+        else:
+            print(f"unknown argument: {arg}", file=sys.stderr)
+            return 1
+
+    cmds = [["/bin/true"]] + [[t, URL] for t in [trurl] + others]
+    width = max(len(c[0]) for c in cmds)
+    print(f"{runs} runs of '{PROGNAME} {URL}', microseconds per run")
+    print(f"{'':{width}} {'p10':>7} {'median':>7} {'p90':>7}")
+    for cmd in cmds:
+        result = measure(cmd, runs)
+        if not result:
+            return 1
+        print(f"{cmd[0]:{width}} {result[0]:7.0f} {result[1]:7.0f} "
+              f"{result[2]:7.0f}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
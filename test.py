@@ -23,6 +23,7 @@
 #
 ##########################################################################
 
+import re
 import sys
 from os import getcwd, path
 import json
@@ -62,6 +63,16 @@ def testComponent(value, exp):
         for alt in exp:
             if value == alt:
                 return True
+    elif isinstance(exp, dict) and isinstance(value, str):
+        # for output that differs between runs, like timings: "match" is a
+        # regular expression for all of it and the numbers captured by
+        # "descending" must come in non-increasing order
+        if not re.fullmatch(exp["match"], value):
+            return False
+        if "descending" in exp:
+            found = [int(n) for n in re.findall(exp["descending"], value)]
+            return found == sorted(found, reverse=True)
+        return True
 
     return value == exp
 
@@ -88,6 +99,7 @@ class TestCase:
         self.runnerCmd = runnerCmd
         self.baseCmd = baseCmd
         self.arguments = testCase["input"]["arguments"]
+        self.stdin = testCase["input"].get("stdin")
         self.expected = testCase["expected"]
         self.commandOutput: CommandOutput = None
         self.testPassed: bool = False
@@ -107,7 +119,7 @@ class TestCase:
             args = VALGRINDARGS + [self.baseCmd] + self.arguments
 
         output = run(
-            cmd + args,
+            cmd + args, input=self.stdin,
             stdout=PIPE, stderr=PIPE,
             encoding="utf-8"
         )
@@ -0,0 +1,100 @@
+#ifndef TRURL_H
+#define TRURL_H
+/***************************************************************************
+ *                             _                   _
+ *  Project                   | |_ _ __ _   _ _ __| |
+ *                            | __| '__| | | | '__| |
+ *                            | |_| |  | |_| | |  | |
+ *                             \__|_|   \__,_|_|  |_|
+ *
+ * Copyright (C) Daniel Stenberg, <daniel@haxx.se>, et al.
+ *
+ * This software is licensed as described in the file COPYING, which
+ * you should have received as part of this distribution. The terms
+ * are also available at https://curl.se/docs/copyright.html.
+ *
+ * You may opt to use, copy, modify, merge, publish, distribute and/or sell
+ * copies of the Software, and permit persons to whom the Software is
+ * furnished to do so, under the terms of the COPYING file.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ * SPDX-License-Identifier: curl
+ *
+ ***************************************************************************/
+
+/*
+ * libtrurl - the trurl engine as a library.
+ *
+ * A context is created with trurl_new() and configured once with
+ * trurl_setopt(), using the same options as the trurl command line tool.
+ * Each trurl_url() call then does what 'trurl [options] URL' does for a
+ * single URL, but the output ends up in a buffer. A context can be used for
+ * any number of URLs, but only by one thread at a time. Separate contexts
+ * can be used in parallel.
+ *
+ * The library never writes to stdout or stderr and never exits. Notes that
+ * the tool shows are dropped, errors are returned. A URL that cannot be
+ * handled is an error, as if --verify was used.
+ *
+ * The application is responsible for curl_global_init().
+ */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* the same numbers as the trurl exit codes */
+typedef enum {
+  TRURLE_OK,
+  TRURLE_FILE,      /* 1 - a file could not be opened or read */
+  TRURLE_APPEND,    /* 2 - --append mistake */
+  TRURLE_ARG,       /* 3 - an option misses its argument */
+  TRURLE_FLAG,      /* 4 - an option mistake */
+  TRURLE_SET,       /* 5 - a --set problem */
+  TRURLE_MEM,       /* 6 - out of memory */
+  TRURLE_URL,       /* 7 - could not get a URL out of the set components */
+  TRURLE_TRIM,      /* 8 - a --qtrim problem */
+  TRURLE_BADURL,    /* 9 - the URL cannot be parsed */
+  TRURLE_GET,       /* 10 - bad --get syntax */
+  TRURLE_ITER,      /* 11 - bad --iterate syntax */
+  TRURLE_REPL,      /* 12 - a --replace problem */
+  TRURLE_TOO_SMALL  /* 13 - the output does not fit in the buffer */
+} TRURLcode;
+
+struct trurl;
+
+/* a new context without options, NULL if out of memory */
+struct trurl *trurl_new(void);
+
+/*
+ * Set the options, given as 'argc' strings in 'argv' just like on the
+ * command line. It can be called once per context. URLs, --url, --url-file,
+ * --help and --version are not supported.
+ */
+TRURLcode trurl_setopt(struct trurl *t, int argc, const char **argv);
+
+/*
+ * Process 'url' (NULL works like no URL on the command line) and store the
+ * zero terminated output in 'buf' of 'size' bytes. The output is exactly
+ * what the tool outputs, including newlines and JSON array brackets. '*len'
+ * is set to the output length. If the output does not fit,
+ * TRURLE_TOO_SMALL is returned, nothing is stored and '*len' is the size
+ * needed, excluding the zero terminator.
+ */
+TRURLcode trurl_url(struct trurl *t, const char *url, char *buf,
+                    size_t size, size_t *len);
+
+/* the error message for the most recent failure in the context */
+const char *trurl_errmsg(struct trurl *t);
+
+void trurl_free(struct trurl *t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TRURL_H */
@@ -0,0 +1,517 @@
+#ifndef TRURL_INT_H
+#define TRURL_INT_H
+/***************************************************************************
+ *                             _                   _
+ *  Project                   | |_ _ __ _   _ _ __| |
+ *                            | __| '__| | | | '__| |
+ *                            | |_| |  | |_| | |  | |
+ *                             \__|_|   \__,_|_|  |_|
+ *
+ * Copyright (C) Daniel Stenberg, <daniel@haxx.se>, et al.
+ *
+ * This software is licensed as described in the file COPYING, which
+ * you should have received as part of this distribution. The terms
+ * are also available at https://curl.se/docs/copyright.html.
+ *
+ * You may opt to use, copy, modify, merge, publish, distribute and/or sell
+ * copies of the Software, and permit persons to whom the Software is
+ * furnished to do so, under the terms of the COPYING file.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ * SPDX-License-Identifier: curl
+ *
+ ***************************************************************************/
+
+/*
+ * Internals shared by the library (libtrurl.c) and the trurl tool
+ * (trurl.c). This is not an API, applications use trurl.h.
+ */
+
+#ifdef _WIN32
+#ifndef _CRT_SECURE_NO_WARNINGS
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <curl/curl.h>
+
+/*
+ * USDT probes for bpftrace, perf and friends, when <sys/sdt.h> is around.
+ * A probe is a nop instruction until a tracer attaches to it. Build with
+ * TRURL_NO_PROBES defined to leave them out.
+ */
+#if !defined(TRURL_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define HAVE_PROBES
+#endif
+#endif
+#ifdef HAVE_PROBES
+/* the URL length and the number of query pairs */
+#define PROBE(name, o) DTRACE_PROBE2(trurl, name, (o)->urllen, (o)->nqpairs)
+#else
+#define PROBE(name, o) do {} while(0)
+#endif
+
+#if defined(_MSC_VER) && (_MSC_VER < 1800)
+typedef enum {
+  bool_false = 0,
+  bool_true  = 1
+} bool;
+#define false bool_false
+#define true  bool_true
+#else
+#include <stdbool.h>
+#endif
+
+/* noreturn attribute */
+#ifndef TRURL_NORETURN
+#if (defined(__GNUC__) && (__GNUC__ >= 3)) || defined(__clang__) || \
+  defined(__IAR_SYSTEMS_ICC__)
+#  define TRURL_NORETURN  __attribute__((__noreturn__))
+#elif defined(_MSC_VER)
+#  define TRURL_NORETURN  __declspec(noreturn)
+#else
+#  define TRURL_NORETURN
+#endif
+#endif
+
+#define PROGNAME        "trurl"
+
+#define OUTBUF_SIZE 16384 /* initial output buffer size */
+
+#define MAX_QPAIRS 1000
+#define MAX_WORKERS 256 /* most --workers threads */
+#define MAX_PROGRESS 86400 /* longest --progress interval, a day */
+#define MAX_SLOWEST 10000  /* most --slowest URLs kept */
+#define BLOOM_BLOCK 64     /* --unique-approx block size, a cache line */
+#define MAX_TOP 10000000   /* most --top keys */
+
+/* error codes */
+#define ERROR_FILE   1
+#define ERROR_APPEND 2  /* --append mistake */
+#define ERROR_ARG    3  /* a command line option misses its argument */
+#define ERROR_FLAG   4  /* a command line flag mistake */
+#define ERROR_SET    5  /* a --set problem */
+#define ERROR_MEM    6  /* out of memory */
+#define ERROR_URL    7  /* could not get a URL out of the set components */
+#define ERROR_TRIM   8  /* a --qtrim problem */
+#define ERROR_BADURL 9  /* if --verify is set and the URL cannot parse */
+#define ERROR_GET    10 /* bad --get syntax */
+#define ERROR_ITER   11 /* bad --iterate syntax */
+#define ERROR_REPL   12 /* a --replace problem */
+
+
+struct var {
+  const char *name;
+  CURLUPart part;
+};
+
+struct string {
+  char *str;
+  size_t len;
+};
+
+struct arenachunk;
+
+/* one --iterate component, the "item1 item2 item2" list is walked in
+   place and the current item is copied to a zero terminated buffer. With
+   --iterate-file the items are instead read from the file one line at a
+   time, and the file is rewound when the iterator wraps around. */
+struct iterinfo {
+  const char *arg;  /* [component]=[list] or [component]=[file] */
+  bool fromfile;
+  const struct var *v;
+  bool urlencode;
+  const char *list; /* first item */
+  const char *next; /* next item, NULL after the last one */
+  FILE *file;       /* --iterate-file */
+  const char *name; /* file name */
+  char *value;      /* current item */
+  size_t size;      /* allocated size of 'value' */
+};
+
+/* --stats, the stages the time is split into */
+enum stage {
+  STAGE_OTHER,
+  STAGE_READ,      /* reading --url-file */
+  STAGE_PARSE,     /* parsing URLs */
+  STAGE_NORMALIZE, /* --set, --append path, normalizing components */
+  STAGE_QUERY,     /* the query pair operations */
+  STAGE_FORMAT,    /* producing the output */
+  STAGE_WRITE,     /* writing the output */
+  STAGE_LAST
+};
+
+#define STATS_CODES 64   /* CURLUcodes counted, higher ones count as the
+                            last */
+#define STATS_BUCKETS 496 /* latency histogram size, see histindex() */
+
+/* --slowest, one of the slowest URLs */
+struct slowurl {
+  uint64_t ns;
+  uint64_t stagetime[STAGE_LAST];
+  char *url;
+};
+
+struct stats {
+  uint64_t in;  /* URLs */
+  uint64_t out; /* URLs output, --iterate can output more than 'in' */
+  uint64_t failures[STATS_CODES]; /* parse failures by CURLUcode */
+  uint64_t stagetime[STAGE_LAST]; /* nanoseconds */
+  uint64_t latency[STATS_BUCKETS]; /* URLs per duration range */
+  uint64_t maxlatency; /* nanoseconds */
+  uint64_t last;    /* when the current stage started */
+  enum stage stage; /* current */
+  struct slowurl *slow; /* min-heap of the slowest URLs, on ns */
+  unsigned int nslow;   /* used entries */
+  unsigned int maxslow; /* --slowest */
+  bool show;        /* --stats */
+  bool json;        /* --stats-json */
+};
+
+/* --unique, fingerprints of the output so far */
+struct uniqset {
+  uint64_t *hash;   /* open addressing table, 0 is a free slot */
+  uint64_t *where;  /* --unique-exact: offset of the output in 'data' */
+  char *data;       /* --unique-exact: all output kept, length prefixed */
+  size_t datalen;
+  size_t datasize;
+  size_t size;      /* slots, a power of two */
+  size_t count;     /* used slots */
+  uint64_t dropped; /* repeats not output */
+  uint64_t collisions; /* --unique-exact: same fingerprint, other output */
+  bool plain;       /* --unique or --unique-exact was given */
+  bool exact;
+
+  /* --unique-approx, a blocked Bloom filter instead of the table */
+  unsigned char *bloom;  /* BLOOM_BLOCK bytes per block */
+  uint64_t blocks;
+  unsigned int k;        /* bits set per output */
+  double fprate;         /* asked for */
+  const char *state;     /* --unique-state, file to load and save */
+};
+
+/* --count-by, one key and its count */
+struct countkey {
+  uint64_t hash;
+  uint64_t count;
+  uint64_t error; /* --top: the count can be this much too high */
+  size_t key;     /* offset in 'keys' */
+  size_t len;
+  char *topkey;   /* --top: allocated, the key gets replaced */
+  size_t slot;    /* index in 'slot' */
+};
+
+struct counter {
+  char *format;           /* the --get format that makes the key */
+  struct countkey *entry; /* --top: a min-heap on count */
+  size_t nentries;
+  size_t maxentries;      /* allocated */
+  size_t *slot;           /* open addressing, entry index + 1, 0 is free */
+  size_t nslots;          /* a power of two */
+  char *keys;             /* all keys without --top */
+  size_t keyslen;
+  size_t keyssize;
+  size_t top;             /* --top, 0 counts every key */
+};
+
+/* --cardinality, a HyperLogLog sketch per component */
+#define HLL_BITS 14 /* index bits, the sketch has 2^HLL_BITS registers */
+#define HLL_REGS (1 << HLL_BITS)
+
+struct sketch {
+  const char *name;  /* the component, points into 'names' */
+  char *format;      /* the --get format for it, NULL for query-keys */
+  unsigned char reg[HLL_REGS];
+};
+
+struct cardinality {
+  char *names;       /* copy of the argument, split at the commas */
+  struct sketch *sketch;
+  size_t nsketches;
+};
+
+/* --where, the expression compiled into a tree */
+enum whereop {
+  WHERE_OR,
+  WHERE_AND,
+  WHERE_NOT,
+  WHERE_EQ,      /* component == "value" */
+  WHERE_NE,      /* component != "value" */
+  WHERE_MATCH,   /* component ~ "pattern" */
+  WHERE_NOMATCH, /* component !~ "pattern" */
+  WHERE_EXISTS   /* component exists */
+};
+
+struct wherenode {
+  enum whereop op;
+  size_t left;              /* node index, for OR, AND and NOT */
+  size_t right;             /* node index, for OR and AND */
+  unsigned int depth;       /* of the tree below, for OR, AND and NOT */
+  char *format;             /* the --get format that gets the component */
+  const struct var *var;    /* for exists, NULL for url and query:key */
+  bool computed;            /* for exists, {ipclass}, {suffix}... */
+  const char *qkey;         /* for exists, query:key */
+  size_t qkeylen;
+  char *value;              /* to compare with */
+  size_t vlen;
+};
+
+struct where {
+  struct wherenode *node;
+  size_t nnodes;
+  size_t root;
+};
+
+/* --exclude-hosts and --only-hosts, a trie of the domain name labels from
+   the top-level domain down. The edges are in a hash table on the parent
+   node and the label, so that a precompiled list can be used as mapped */
+struct hostnode {
+  uint32_t parent;   /* node number, the root is 0 */
+  uint32_t node;     /* the node this leads to, 0 marks a free slot */
+  uint32_t label;    /* offset in 'labels' */
+  unsigned char len; /* label length */
+  unsigned char end; /* a listed domain ends in this node, or PSL_* */
+  unsigned char pad[2];
+};
+
+struct hostlist {
+  const char *flag;      /* the option, for messages */
+  const char *file;
+  struct hostnode *slot; /* a power of two of them */
+  size_t nslots;
+  uint32_t nodes;        /* used node numbers, the root included */
+  char *labels;          /* all the labels, lowercase */
+  size_t labelslen;
+  size_t labelssize;
+  void *map;             /* a precompiled list as loaded */
+  size_t maplen;
+};
+
+/* --psl, the node flags for the rules in a host list trie */
+#define PSL_RULE 1      /* a rule ends in this node */
+#define PSL_EXCEPTION 2 /* an exception rule, "!" in the list */
+
+/* {ipclass} and --where-ip, a radix tree of address prefixes where a node
+   is only made where prefixes part ways */
+#define IP_KEEP 1 /* --where-ip outputs the address */
+#define IP_DROP 2 /* --where-ip drops the address */
+
+struct ipnode {
+  unsigned char key[16]; /* the prefix, IPv4 as ::ffff:a.b.c.d */
+  unsigned int bits;     /* prefix length */
+  uint32_t child[2];     /* node index, 0 for none */
+  uint32_t name;         /* the class, offset + 1 in 'names', 0 for none */
+  unsigned char action;  /* --where-ip: IP_KEEP, IP_DROP or 0 */
+};
+
+struct iptree {
+  struct ipnode *node;   /* the root is the first */
+  size_t nnodes;
+  size_t size;           /* allocated */
+  char *names;           /* the class names, zero terminated */
+  size_t nameslen;
+  size_t namessize;
+};
+
+/* --punycode, --as-idn, puny: and idn:, the latest host conversions */
+#define IDN_ENTRIES 1024
+
+struct idnentry {
+  uint64_t hash;
+  char *host;          /* as in the URL */
+  char *conv;          /* converted, NULL when it failed */
+  CURLUcode rc;        /* from the conversion */
+  unsigned int convert; /* CURLU_PUNYCODE or CURLU_PUNY2IDN */
+  uint32_t chain;      /* next in the same bucket, index + 1, 0 for none */
+  uint32_t newer;      /* the LRU list, index + 1, 0 for none */
+  uint32_t older;
+};
+
+struct idncache {
+  struct idnentry entry[IDN_ENTRIES];
+  uint32_t bucket[IDN_ENTRIES]; /* index + 1 of the first entry, 0 for none */
+  uint32_t nentries;
+  uint32_t newest;     /* index + 1 */
+  uint32_t oldest;
+  uint64_t hits;
+  uint64_t misses;
+};
+
+/* --memo, the output of each input line kept for when it repeats */
+struct memoentry {
+  uint64_t hash;
+  char *data;        /* the line and then its output, NULL when free */
+  uint32_t linelen;
+  uint32_t outlen;
+  uint32_t urls;     /* what it adds to 'urls' */
+  uint32_t chain;    /* next in the bucket or free list, index + 1 */
+  bool used;         /* the CLOCK reference bit */
+};
+
+struct memo {
+  struct memoentry *entry;
+  uint32_t *bucket;  /* index + 1 of the first entry, 0 for none */
+  uint32_t nentries; /* a power of two */
+  uint32_t free;     /* first free entry, index + 1 */
+  uint32_t hand;     /* the CLOCK hand */
+  size_t bytes;      /* data used */
+  size_t maxbytes;
+  size_t size;       /* asked for */
+  uint64_t hits;
+  uint64_t misses;
+};
+
+/* output collected before it is written to stdout */
+struct outbuf {
+  char *buf;
+  size_t len;  /* used */
+  size_t size; /* allocated */
+};
+
+struct option {
+  struct curl_slist *url_list;
+  struct curl_slist *append_path;
+  struct curl_slist *append_query;
+  struct curl_slist *set_list;
+  struct curl_slist *trim_list;
+  struct curl_slist *replace_list;
+  struct iterinfo *iters; /* one per --iterate, in command line order */
+  size_t niters;
+  const char *redirect;
+  const char *qsep;
+  const char *format;
+  FILE *url;
+  struct outbuf out;
+  bool urlopen;
+  bool jsonout;
+  bool verify;
+  bool accept_space;
+  bool curl;
+  bool default_port;
+  bool keep_port;
+  bool punycode;
+  bool puny2idn;
+  bool sort_query;
+  bool no_guess_scheme;
+  bool urlencode;
+  bool end_of_options;
+  bool quiet_warnings;
+  bool force_replace;
+  bool fastpath; /* no option prevents the fastparse() shortcut */
+  bool alloc_stats;
+  bool server; /* --server, the tool reads requests from stdin */
+  const char *listen;   /* --listen, Unix domain socket for requests */
+  unsigned int workers; /* --workers, threads answering --listen requests */
+  struct stats *stats;  /* --stats, NULL unless used */
+  struct uniqset *unique; /* --unique, NULL unless used */
+  const char *countby;    /* --count-by */
+  size_t top;             /* --top */
+  struct counter *counter; /* --count-by, NULL unless used */
+  struct cardinality *cardinality; /* --cardinality, NULL unless used */
+  const char *whereexpr;  /* --where */
+  struct where *where;    /* compiled --where, NULL unless used */
+  struct hostlist *exclude; /* --exclude-hosts, NULL unless used */
+  struct hostlist *only;    /* --only-hosts, NULL unless used */
+  const char *compilehosts; /* --compile-hosts, file to save the list in */
+  const char *whereip;    /* --where-ip */
+  struct iptree *iptree;  /* {ipclass} and --where-ip, NULL until used */
+  struct idncache *idn;   /* host conversions, NULL until one is made */
+  struct memo *memo;      /* --memo, NULL unless used */
+  bool memoskip;          /* the current line is not kept for --memo */
+  const char *pslfile;    /* --psl */
+  struct hostlist *psl;   /* {suffix} and {registrable}, NULL unless --psl */
+  unsigned int progress; /* --progress, seconds between reports */
+  bool library; /* used via the library API, see trurl.h */
+
+  /* -- the URL being worked on -- */
+  CURLU *uh;
+  CURLU *work; /* copy of 'uh' for one --iterate combination */
+  char *ourl; /* 'uh' as a string while it is verified */
+  struct string qpairs[MAX_QPAIRS]; /* encoded */
+  struct string qpairsdec[MAX_QPAIRS]; /* decoded */
+  size_t nqpairs; /* how many is stored */
+#ifdef HAVE_PROBES
+  size_t urllen; /* of the input URL */
+#endif
+  struct arenachunk *arena;        /* first chunk */
+  struct arenachunk *arenacurrent; /* allocate from here on */
+
+  /* -- library -- */
+  jmp_buf *jmp; /* errors jump here instead of exiting, when set */
+  int error;    /* the exit code for the jump */
+  const char **args; /* copy of the trurl_setopt() arguments */
+  char *argbuf;      /* ... stored here */
+  char errmsg[256];
+
+  /* -- stats -- */
+  unsigned int urls;
+  unsigned long allocs; /* allocations done by trurl itself */
+};
+
+
+
+/* parse the command line options, and URLs unless it is the library */
+void trurl_args(struct option *o, int argc, const char **argv);
+
+/* process one URL, or none, and what --iterate makes out of it */
+void trurl_singleurl(struct option *o, const char *url);
+
+void trurl_json_begin(struct option *o);
+void trurl_json_end(struct option *o);
+void trurl_outflush(struct option *o);
+void trurl_cleanup_options(struct option *o);
+void trurl_warnf(struct option *o, const char *fmt, ...);
+
+/* --stats: monotonic nanoseconds, and the start of a new stage */
+uint64_t trurl_nanotime(void);
+void trurl_stagestart(struct option *o, enum stage stage);
+void trurl_stats_url(struct option *o, const char *url, uint64_t ns,
+                     const uint64_t *before);
+void trurl_stats_show(struct option *o);
+void trurl_unique_show(struct option *o);
+void trurl_unique_load(struct option *o);
+void trurl_count_show(struct option *o);
+void trurl_cardinality_show(struct option *o);
+void trurl_hosts_save(struct option *o);
+void trurl_unique_save(struct option *o);
+void trurl_memo_show(struct option *o);
+#define STAGE(o, s) do {                        \
+    if((o)->stats)                              \
+      trurl_stagestart(o, s);                   \
+  } while(0)
+
+/*
+ * Functions that are static unless built for the microbenchmark, which
+ * measures them on their own, see microbench.c.
+ */
+#ifdef TRURL_MICROBENCH
+#define UNITTEST
+UNITTEST void arenareset(struct option *o);
+UNITTEST void jsonString(struct option *o, const char *in, size_t len,
+                         bool lowercase);
+UNITTEST char *decodequery(struct option *o, char *str, size_t len,
+                           size_t *olen);
+UNITTEST char *encodequery(struct option *o, char *str, size_t len);
+UNITTEST struct string *memdupzero(struct option *o, char *source,
+                                   size_t len, bool *modified);
+UNITTEST int cmpfunc(const void *p1, const void *p2);
+UNITTEST char *canonical_path(const char *path);
+#else
+#define UNITTEST static
+#endif
+
+TRURL_NORETURN void trurl_errorf(struct option *o, int exit_code,
+                                 const char *fmt, ...);
+
+/* server.c, answer requests on stdin or a Unix domain socket */
+void trurl_server(struct option *o, int argc, const char **argv);
+void trurl_listen(struct option *o, int argc, const char **argv);
+
+#endif /* TRURL_INT_H */